@@ -0,0 +1,45 @@
+#!/bin/sh
+# Runs each program in test_code on both backends and compares the number
+# of instructions generated and the average wall time of a run, with the
+# P-machine timed both with its JIT and with --no-jit. Programs which
+# don't finish within LIMIT seconds are reported as timing out.
+# usage: ./benchmark.sh [path to dalgol] [runs per program]
+DALGOL=${1:-./dalgol}
+RUNS=${2:-5}
+LIMIT=5
+
+run() {
+    case $1 in
+        interpreted) timeout $LIMIT "$DALGOL" $3 --no-jit "$2" 2>/dev/null ;;
+        *) timeout $LIMIT "$DALGOL" $3 -backend=$1 "$2" 2>/dev/null ;;
+    esac
+}
+
+count() {
+    run $1 "$2" -stats | grep -c '^[0-9]*: ('
+}
+
+seconds() {
+    start=$(date +%s.%N)
+    i=0
+    while [ $i -lt $RUNS ]; do
+        run $1 "$2" >/dev/null
+        if [ $? -eq 124 ]; then
+            echo "timeout"
+            return
+        fi
+        i=$((i+1))
+    done
+    end=$(date +%s.%N)
+    echo "$start $end $RUNS" | awk '{ printf "%.4f", ($2-$1)/$3 }'
+}
+
+printf "%-28s %8s %8s %10s %10s %10s\n" "program" "p-code" "register" "no-jit s" "p-code s" "register s"
+for prog in test_code/*.alg; do
+    if run register "$prog" | grep -q '^Register machine:'; then
+        printf "%-28s %s\n" "$prog" "(not supported by the register machine)"
+        continue
+    fi
+    printf "%-28s %8d %8d %10s %10s %10s\n" "$prog" $(count pcode "$prog") $(count register "$prog") \
+        $(seconds interpreted "$prog") $(seconds pcode "$prog") $(seconds register "$prog")
+done
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Runs each program in test_code at -O0, -O1 and -O2 and reports those
+# whose output at -O1 or -O2 differs from -O0, as what the optimizer
+# does must never change what a program prints. Programs which don't
+# finish within LIMIT seconds are skipped. It also checks that the JIT
+# compiles a procedure which loops only by calling itself in tail
+# position, and that calls made as statements in a loop don't grow
+# the stack.
+# usage: ./check.sh [path to dalgol]
+DALGOL=${1:-./dalgol}
+LIMIT=5
+failed=0
+
+for prog in test_code/*.alg; do
+    expected=$(timeout $LIMIT "$DALGOL" -O0 "$prog" 2>&1)
+    if [ $? -eq 124 ]; then
+        printf "%-28s %s\n" "$prog" "timeout"
+        continue
+    fi
+    for level in -O1 -O2; do
+        if [ "$(timeout $LIMIT "$DALGOL" $level "$prog" 2>&1)" != "$expected" ]; then
+            printf "%-28s %s\n" "$prog" "differs at $level"
+            failed=1
+        fi
+    done
+done
+
+if timeout $LIMIT "$DALGOL" -stats test_code/tail-loop.alg | grep -q '^JIT: 0 of'; then
+    printf "%-28s %s\n" "test_code/tail-loop.alg" "not compiled by the JIT"
+    failed=1
+fi
+
+slots=$(timeout $LIMIT "$DALGOL" -stats test_code/call-stmt.alg | sed -n 's/^Stack high-water mark: \([0-9]*\) slots\.$/\1/p')
+if [ -z "$slots" ] || [ "$slots" -gt 1000 ]; then
+    printf "%-28s %s\n" "test_code/call-stmt.alg" "stack grew to ${slots:-?} slots"
+    failed=1
+fi
+exit $failed
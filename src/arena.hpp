@@ -0,0 +1,99 @@
+#ifndef arena_hpp
+#define arena_hpp
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+using namespace std;
+
+const size_t ARENA_BLOCK_SIZE = 64 << 10;
+
+//A bump pointer allocator for what the compiler makes a piece at a time
+//and lets go of all at once: syntax trees and symbol tables. Nothing in
+//it is freed on its own. reset() runs the destructors of the objects
+//that have one, for the strings in tokens and entries, then rewinds to
+//the first block. The blocks are kept, so an arena that is reset for
+//every compile stops asking the system for memory once it has grown to
+//fit the largest.
+class Arena {
+    private:
+        struct Block {
+            char* base;
+            size_t size;
+        };
+        struct Finalizer {
+            void* object;
+            void (*destroy)(void*);
+        };
+        vector<Block> blocks;
+        int current;  //the block being handed out from
+        size_t used;  //bytes of it handed out
+        vector<Finalizer> finalizers;
+        void* allocate(size_t size, size_t align) {
+            size_t at = (used + align-1) & ~(align-1);
+            if (current < 0 || at + size > blocks[current].size) {
+                current++;
+                if (current == blocks.size() || blocks[current].size < size) {
+                    Block nb = { (char*)malloc(max(size, ARENA_BLOCK_SIZE)), max(size, ARENA_BLOCK_SIZE) };
+                    if (nb.base == nullptr)
+                        throw bad_alloc();
+                    blocks.insert(blocks.begin() + current, nb);
+                }
+                at = 0;
+            }
+            used = at + size;
+            return blocks[current].base + at;
+        }
+        void release() {
+            reset();
+            for (Block& b : blocks)
+                free(b.base);
+            blocks.clear();
+        }
+    public:
+        Arena() {
+            current = -1;
+            used = 0;
+        }
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+        Arena(Arena&& other) : Arena() {
+            *this = move(other);
+        }
+        Arena& operator=(Arena&& other) {
+            if (this != &other) {
+                release();
+                blocks = move(other.blocks);
+                finalizers = move(other.finalizers);
+                current = other.current;
+                used = other.used;
+                other.blocks.clear();
+                other.finalizers.clear();
+                other.current = -1;
+                other.used = 0;
+            }
+            return *this;
+        }
+        ~Arena() {
+            release();
+        }
+        template <class T, class... Args>
+        T* make(Args&&... args) {
+            T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (!is_trivially_destructible<T>::value)
+                finalizers.push_back({ obj, [](void* p) { ((T*)p)->~T(); } });
+            return obj;
+        }
+        //everything made since the last reset is gone, the blocks stay
+        void reset() {
+            for (int i = finalizers.size()-1; i >= 0; i--)
+                finalizers[i].destroy(finalizers[i].object);
+            finalizers.clear();
+            current = -1;
+            used = 0;
+        }
+};
+
+#endif
\ No newline at end of file
@@ -5,7 +5,10 @@
 #include "syntaxtree.hpp"
 #include "vminst.hpp"
 #include "scoping_st.hpp"
+#include "inliner.hpp"
+#include "typeinfer.hpp"
 #include <unordered_map>
+#include <unordered_set>
 using namespace std;
 
 
@@ -14,16 +17,34 @@ class PCodeGenerator {
     private:
         bool should_trace;
         ScopingSymbolTable st;
-        string makeLabel() {
-            static int labelnum = 0;
-            return "L" + to_string(labelnum++);
-        }
         vector<Instruction> codepage;
+        //address of each label, indexed by label number
+        vector<int> labelAddrs;
+        //entry address of each procedure, and the CAL instructions
+        //waiting on a procedure which has not been generated yet
+        unordered_map<string, int> procAddrs;
+        unordered_map<string, vector<int>> pendingCalls;
+        //self calls which are the last thing their procedure does
+        unordered_set<ASTNode*> tailCalls;
+        unordered_set<ASTNode*> resultCalls; //call statements whose value a procedure returns
+        //calls expanded in place, numbered so each gets its own variables
+        InlineAnalyzer inliner;
+        TypeInference types;
+        unordered_map<ASTNode*, int> inlineSites;
+        int numInlineSites;
+        InlineProc* inlining;
+        int inlineSite;
         bool genparam;
         int cPos;
         int highCI;
-        void emit(Inst op, Value operand, Value nestLevel) {
-            codepage[cPos++] = Instruction(op, operand, nestLevel);
+        //codepage always holds exactly highCI instructions: emitting past
+        //the end grows it, emitting after a backup() overwrites in place.
+        void emit(Inst op, Value operand, Value nestLevel, int aux = 0) {
+            if (cPos == codepage.size())
+                codepage.push_back(Instruction(op, operand, nestLevel, aux));
+            else
+                codepage[cPos] = Instruction(op, operand, nestLevel, aux);
+            cPos++;
             if (highCI < cPos) highCI = cPos;
         }
         void emit(Inst op, Value operand) {
@@ -32,33 +53,53 @@ class PCodeGenerator {
         void emit(Inst op) {
             emit(op, makeNil(), makeInt(0));
         }
-        string emitLabel() {
-            string label = makeLabel();
-            emit(LAB, makeString(label));
+        int emitLabel() {
+            int label = labelAddrs.size();
+            labelAddrs.push_back(cPos);
+            emit(LAB, makeString("L" + to_string(label)));
             return label;
         }
-        int getLabelAddr(string label) {
-            int i = 0;
-            while (i < codepage.size()) {
-                if (codepage[i].instruction == LAB && label == toStdString(codepage[i].operand))
-                    break;
-                i++;
-            }
-            return i;
+        int getLabelAddr(int label) {
+            return labelAddrs[label];
         }
+        //Returns the entry address of funcname, or -1 if it hasn't been
+        //generated yet, in which case the CAL about to be emitted at cPos
+        //is queued to be patched once it is.
         int getFunctionAddr(string funcname) {
-            int i = 0;
-            while (i < codepage.size()) {
-                if (codepage[i].instruction == ENT && funcname == toStdString(codepage[i].operand))
-                    break;
-                i++;
+            auto it = procAddrs.find(funcname);
+            if (it != procAddrs.end())
+                return it->second;
+            pendingCalls[funcname].push_back(cPos);
+            return -1;
+        }
+        void backpatch(vector<int>& calls, int addr) {
+            for (int at : calls)
+                codepage[at].operand = makeInt(addr);
+        }
+        void defineFunction(string funcname) {
+            procAddrs[funcname] = cPos;
+            auto it = pendingCalls.find(funcname);
+            if (it != pendingCalls.end()) {
+                backpatch(it->second, cPos);
+                pendingCalls.erase(it);
+            }
+        }
+        //calls to procedures which were never defined are sent to the HALT
+        //at the end of the program. They stay queued, so that a procedure
+        //defined later on in the repl still resolves them.
+        void resolveUndefinedCalls(int haltAddr) {
+            for (auto& pending : pendingCalls) {
+                cout<<"Error: call to undefined procedure: "<<pending.first<<endl;
+                backpatch(pending.second, haltAddr);
             }
-            return i;
         }
         int skipEmit(int spaces) {
             int old = cPos;
             cPos += spaces;
-            if (highCI < cPos) highCI = cPos;
+            if (highCI < cPos) {
+                highCI = cPos;
+                codepage.resize(highCI);
+            }
             return old;
         } 
         void backup(int addr) {
@@ -67,6 +108,19 @@ class PCodeGenerator {
         void restore() {
             cPos = highCI;
         }
+        string inlineVarName(string name, int site) {
+            return name + "@" + to_string(site);
+        }
+        //Inside an inlined body the callee's own parameters and locals are
+        //the variables buildST set aside for the call site, any other name
+        //is resolved from the callee's scope rather than the caller's.
+        LocalVar* lookup(string name) {
+            if (inlining == nullptr)
+                return st.getVar(name);
+            if (inlining->owns(name))
+                return st.getVar(inlineVarName(name, inlineSite));
+            return st.getVarFrom(inlining->def->data.strval, name);
+        }
         void genIfStmt(ASTNode* node, bool isAddr) {
             genCode(node->child[0], isAddr);
             int s1 = skipEmit(1);
@@ -83,7 +137,7 @@ class PCodeGenerator {
             restore();
         }
         void genWhileStmt(ASTNode* node, bool isAddr) {
-            string test_label = emitLabel();
+            int test_label = emitLabel();
             genCode(node->child[0], isAddr);
             int s1 = skipEmit(1);
             genCode(node->child[1], isAddr);
@@ -93,12 +147,68 @@ class PCodeGenerator {
             emit(JPC, makeInt(c1));
             restore();
         }
+        bool hasRefParams(ASTNode* proc) {
+            for (ASTNode* p = proc->child[0]; p != nullptr; p = p->next)
+                if (p->nk == STMT_NODE && p->type.stmt == REF_STMT)
+                    return true;
+            return false;
+        }
+        //A return of a call to proc is in tail position when it is the last
+        //statement of the body, or of either branch of an if which is. A ref
+        //argument could point into the frame the tail call overwrites, so
+        //procedures with ref parameters are left alone.
+        void markTailCalls(ASTNode* list, ASTNode* proc) {
+            if (list == nullptr || hasRefParams(proc))
+                return;
+            while (list->next != nullptr)
+                list = list->next;
+            if (list->nk != STMT_NODE)
+                return;
+            if (list->type.stmt == RETURN_STMT) {
+                ASTNode* call = list->child[0];
+                if (call != nullptr && call->nk == EXPR_NODE && call->type.expr == FUNC_EXPR &&
+                    call->data.strval == proc->data.strval && call->next == nullptr)
+                    tailCalls.insert(call);
+            } else if (list->type.stmt == IF_STMT) {
+                markTailCalls(list->child[1], proc);
+                markTailCalls(list->child[2], proc);
+            }
+        }
+        bool isCall(ASTNode* node) {
+            return node != nullptr && node->nk == EXPR_NODE && node->type.expr == FUNC_EXPR && node->next == nullptr;
+        }
+        //A call made as a statement leaves its result on the stack. That
+        //is what the procedure returns when the call is the last statement
+        //of the body, or of either branch of an if which is. Anywhere else
+        //it is popped, or a loop making the call would grow the stack.
+        void markResultCalls(ASTNode* list) {
+            if (list == nullptr)
+                return;
+            while (list->next != nullptr)
+                list = list->next;
+            if (list->nk != STMT_NODE)
+                return;
+            if (list->type.stmt == EXPR_STMT && isCall(list->child[0])) {
+                resultCalls.insert(list);
+            } else if (list->type.stmt == IF_STMT) {
+                markResultCalls(list->child[1]);
+                markResultCalls(list->child[2]);
+            }
+        }
+        void genExprStmt(ASTNode* node, bool isAddr) {
+            genCode(node->child[0], isAddr);
+            if (isCall(node->child[0]) && resultCalls.count(node) == 0)
+                emit(DEC, makeInt(1));
+        }
         void genFunctionDefinition(ASTNode* node, bool isAddr) {
+            markTailCalls(node->child[1], node);
+            markResultCalls(node->child[1]);
             st.openScope(node->data.strval);
             int s1 = skipEmit(1);
+            defineFunction(node->data.strval);
             emit(ENT, makeString(node->data.strval));
             genCode(node->child[1], isAddr);
-            emit(RET);
+            emit(RET, makeNil(), makeInt(st.scopeLevel(node->data.strval)));
             int c1 = skipEmit(0);
             backup(s1);
             emit(JMP, makeInt(c1));
@@ -106,13 +216,23 @@ class PCodeGenerator {
             st.closeScope();
         }
         void genLetStmnt(ASTNode* node, bool isAddr) {
-            LocalVar* lv = st.getVar(node->data.strval);
+            //an array's let only sizes it, which buildST has done
+            if (hasSubscript(node))
+                return;
+            LocalVar* lv = lookup(node->data.strval);
             emit(LDA, makeInt(lv->loc), makeInt(lv->depth));
             genCodeNS(node->child[0],false);
-            emit(STN);
+            //an inlined let's value is kept without STN, which
+            //the peephole pass may make destructive out here
+            if (inlining != nullptr) {
+                emit(STO);
+                emit(LOD, makeInt(lv->loc), makeInt(lv->depth));
+            } else {
+                emit(STN);
+            }
         }
         void genRefStmt(ASTNode* node, bool isAddr) {
-            LocalVar* lv = st.getVar(node->data.strval);
+            LocalVar* lv = lookup(node->data.strval);
             emit(LDA, makeInt(lv->loc), makeInt(lv->depth));
             genparam = true;
             genCodeNS(node->child[0],true);
@@ -135,9 +255,9 @@ class PCodeGenerator {
             genCode(node->child[0], isAddr);
             genCode(node->child[1], isAddr);
             switch (node->data.symbol) {
-                case TK_ADD: emit(ADD); break;
-                case TK_SUB: emit(SUB); break;
-                case TK_MUL: emit(MUL); break;
+                case TK_ADD: emit(types.opcodeFor(node, ADD)); break;
+                case TK_SUB: emit(types.opcodeFor(node, SUB)); break;
+                case TK_MUL: emit(types.opcodeFor(node, MUL)); break;
                 case TK_DIV: emit(DIV); break;
                 default: break;
             }
@@ -146,12 +266,12 @@ class PCodeGenerator {
             genCode(node->child[0], isAddr);
             genCode(node->child[1], isAddr);
             switch (node->data.symbol) {
-                case TK_LT: emit(LT); break;
-                case TK_LTE: emit(LTE); break;
-                case TK_GT:  emit(GT); break;
-                case TK_GTE: emit(GTE); break;
-                case TK_EQU: emit(EQU); break;
-                case TK_NEQ: emit(NEQ); break;
+                case TK_LT: emit(types.opcodeFor(node, LT)); break;
+                case TK_LTE: emit(types.opcodeFor(node, LTE)); break;
+                case TK_GT:  emit(types.opcodeFor(node, GT)); break;
+                case TK_GTE: emit(types.opcodeFor(node, GTE)); break;
+                case TK_EQU: emit(types.opcodeFor(node, EQU)); break;
+                case TK_NEQ: emit(types.opcodeFor(node, NEQ)); break;
                 default:
                     break;
             }
@@ -191,7 +311,7 @@ class PCodeGenerator {
         }
         bool isField;
         void generateIDExpression(ASTNode* node, bool isAddr) {
-            LocalVar* lv = st.getVar(node->data.strval);
+            LocalVar* lv = lookup(node->data.strval);
             if (lv == nullptr) {
                 cout<<"Error: attempt to reference undelcared variable: "<<node->data.strval<<endl;
                 emit(HALT);
@@ -200,12 +320,12 @@ class PCodeGenerator {
             if (isField) {
                 emit(LDF, makeInt(lv->loc));
             } else if ((isAddr && !genparam) || hasSubscript(node) || hasField(node)) {
-                emit(LDA, makeInt(lv->loc), makeInt(0));
+                emit(LDA, makeInt(lv->loc), makeInt(lv->depth));
             } else {
                 if (genparam) {
-                    emit(isAddr ? LRP:LDP, makeInt(lv->loc), makeInt(0));
+                    emit(isAddr ? LRP:LDP, makeInt(lv->loc), makeInt(lv->depth));
                 } else {
-                    emit(LOD, makeInt(lv->loc), makeInt(0));
+                    emit(LOD, makeInt(lv->loc), makeInt(lv->depth));
                 }
             }
             if (node->child[LEFTCHILD] != nullptr) {
@@ -230,36 +350,83 @@ class PCodeGenerator {
             genExpr(node->child[RIGHTCHILD], false);
             emit(STO);
         }
-        void genFunctionCall(ASTNode* node, bool isAddr) {
-            emit(MST);
-            ASTNode* t = node->child[1];
+        //The arguments are stored straight into the call site's copies of the
+        //parameters, and the body leaves the result on the stack as RET would.
+        void genInlineCall(ASTNode* node, int site, bool isAddr) {
+            InlineProc* proc = inliner.inlinable(node);
+            int i = 0;
             genparam = true;
-            int sloc = 0;
-            while (t != nullptr) {
+            for (ASTNode* t = node->child[1]; t != nullptr; t = t->next) {
+                LocalVar* lv = st.getVar(inlineVarName(proc->vars[i++], site));
+                emit(LDA, makeInt(lv->loc), makeInt(lv->depth));
                 genCodeNS(t, isAddr);
-                t = t->next;
-                sloc++;
+                emit(STO);
             }
             genparam = false;
-            int numLocals = st.scopeSize(node->data.strval)-sloc; 
-            emit(INC, makeInt(numLocals < 0 ? 0:numLocals));
-            emit(CAL, makeInt(getFunctionAddr(node->data.strval)));
+            for (string& local : proc->zeroed) {
+                LocalVar* lv = st.getVar(inlineVarName(local, site));
+                emit(LDA, makeInt(lv->loc), makeInt(lv->depth));
+                emit(LDC, makeInt(0));
+                emit(STO);
+            }
+            inlining = proc;
+            inlineSite = site;
+            genCode(proc->def->child[1], false);
+            if (proc->stackEffect == 0) {
+                LocalVar* lv = lookup(proc->vars.back());
+                emit(LOD, makeInt(lv->loc), makeInt(lv->depth));
+            }
+            inlining = nullptr;
+        }
+        //a tail call has no MST, and its TCL carries the number of
+        //arguments and locals where CAL has the level
+        void genFunctionCall(ASTNode* node, bool isAddr) {
+            auto site = inlineSites.find(node);
+            if (site != inlineSites.end()) {
+                genInlineCall(node, site->second, isAddr);
+                return;
+            }
+            int sloc = 0;
+            for (ASTNode* t = node->child[1]; t != nullptr; t = t->next)
+                sloc++;
+            int numLocals = st.scopeSize(node->data.strval)-sloc;
+            if (numLocals < 0) numLocals = 0;
+            bool tail = tailCalls.count(node) > 0 && sloc <= UINT8_MAX && numLocals <= INT16_MAX;
+            if (!tail)
+                emit(MST);
+            genparam = true;
+            for (ASTNode* t = node->child[1]; t != nullptr; t = t->next)
+                genCodeNS(t, isAddr);
+            genparam = false;
+            if (tail) {
+                emit(TCL, makeInt(getFunctionAddr(node->data.strval)), makeInt(sloc), numLocals);
+                return;
+            }
+            emit(INC, makeInt(numLocals));
+            emit(CAL, makeInt(getFunctionAddr(node->data.strval)), makeInt(st.scopeLevel(node->data.strval)));
         }
         void genBlessExpr(ASTNode* node) {
             int saddr = st.allocStruct(node->child[LEFTCHILD]->data.strval);
             emit(LDA, makeInt(saddr));
         }
+        bool isStringLiteral(ASTNode* node) {
+            return node != nullptr && node->nk == EXPR_NODE && node->type.expr == STR_EXPR && node->next == nullptr;
+        }
         void genMatchRegExpr(ASTNode* node, bool isAddr) {
             genCode(node->child[0], false);
-            genCode(node->child[1], false);
-            emit(MATCHRE);
+            if (isStringLiteral(node->child[1])) {
+                emit(MATCHRE, makeString(node->child[1]->data.strval));
+            } else {
+                genCode(node->child[1], false);
+                emit(MATCHRE);
+            }
         }
         void genExpr(ASTNode* node, bool isAddr) {
             switch (node->type.expr) {
                 case SUBSCRIPT_EXPR: { genSubscriptExpression(node, isAddr); } break;
                 case ID_EXPR:     { generateIDExpression(node, isAddr); } break;
                 case FIELD_EXPR:  { genSubscriptExpression(node, isAddr); } break;
-                case CONST_EXPR:  { emit(LDC, makeReal(stod(node->data.strval))); } break;
+                case CONST_EXPR:  { emit(LDC, node->value); } break;
                 case STR_EXPR:    { emit(LDC, makeString(node->data.strval)); } break;
                 case BINOP_EXPR:  { genBinOp(node, isAddr); } break;
                 case UNOP_EXPR:   { genUnaryOp(node, isAddr); } break;
@@ -275,7 +442,7 @@ class PCodeGenerator {
         void genStmt(ASTNode* node, bool isAddr) {
             switch (node->type.stmt) {
                 case PROGRAM_STMT: { genCode(node->child[0], isAddr); } break;
-                case EXPR_STMT:    { genCode(node->child[0], isAddr); } break;
+                case EXPR_STMT:    { genExprStmt(node, isAddr); } break;
                 case PRINT_STMT:   { genPrintStmt(node, isAddr); } break;
                 case REF_STMT:     { genRefStmt(node, isAddr); }  break;
                 case LET_STMT:     { genLetStmnt(node, isAddr); } break;
@@ -297,8 +464,8 @@ class PCodeGenerator {
             }
         }
         void genCodeParam(ASTNode* node) {
-            LocalVar* lv = st.getVar(node->data.strval);
-            emit(LDP, makeInt(lv->loc), makeInt(0));
+            LocalVar* lv = lookup(node->data.strval);
+            emit(LDP, makeInt(lv->loc), makeInt(lv->depth));
         }
         void genCode(ASTNode* node, bool isAddr) {
             if (node != nullptr) {
@@ -390,6 +557,15 @@ class PCodeGenerator {
                             case BLESS_EXPR: {
 
                             } break;
+                            case FUNC_EXPR: {
+                                InlineProc* proc = inliner.inlinable(node);
+                                if (proc != nullptr) {
+                                    int site = numInlineSites++;
+                                    inlineSites[node] = site;
+                                    for (string& var : proc->vars)
+                                        st.insertVar(inlineVarName(var, site));
+                                }
+                            } break;
                         };
                     } break;
                     default: break;
@@ -400,9 +576,13 @@ class PCodeGenerator {
             }
         }
         void init() {
-            codepage = vector<Instruction>(1000);
+            codepage.clear();
             cPos = 0;
+            highCI = 0;
             isField = false;
+            numInlineSites = 0;
+            inlining = nullptr;
+            inlineSite = 0;
         }
     public:
         PCodeGenerator(bool trace = false) {
@@ -411,24 +591,48 @@ class PCodeGenerator {
             isField = false;
             should_trace = trace;
         }
-        void setContext(ScopingSymbolTable& symbolTable) {
-            st = symbolTable;
-        }
         void setTrace(bool trace) {
             should_trace = trace;
             st.setTrace(trace);
         }
-        vector<Instruction> generate(ASTNode* node) {
+        //largest procedure body, in AST nodes, expanded in place; 0 disables inlining
+        void setInlineLimit(int limit) {
+            inliner.setLimit(limit);
+        }
+        int inlinedCount() {
+            return inlineSites.size();
+        }
+        void setTypeSpecialization(bool enable) {
+            types.setEnabled(enable);
+        }
+        void printTypeStats() {
+            types.printStats();
+        }
+        int globalsEnd() {
+            return st.globalsEnd();
+        }
+        int heapEnd() {
+            return st.heapEnd();
+        }
+        //The returned code page stays owned by the generator, the repl
+        //appends each new line to it.
+        vector<Instruction>& generate(ASTNode* node) {
             if (cPos > 0) cPos--;
+            tailCalls.clear();
+            resultCalls.clear();
+            inlineSites.clear();
             if (should_trace)
                 cout<<"Building Symbol Table: "<<endl;
+            inliner.analyze(node);
             buildST(node);
+            types.infer(node);
             if (should_trace ) {
                 st.print();
                 cout<<"Generating P-Code..."<<endl;
             }
             genCode(node, false);
             emit(HALT);
+            resolveUndefinedCalls(cPos-1);
             if (should_trace)
                 cout<<"Done."<<endl;
             return codepage;
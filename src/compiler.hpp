@@ -2,30 +2,89 @@
 #define compiler_hpp
 #include <vector>
 #include "astbuilder.hpp"
+#include "constfold.hpp"
 #include "codegen.hpp"
+#include "regcodegen.hpp"
 #include "vminst.hpp"
 using namespace std;
 
 class Compiler {
     private:
         ASTBuilder astBuilder;
+        ConstantFolder folder;
         PCodeGenerator codeGenerator;
+        RegisterCodeGenerator regGenerator;
+        ASTNode* parsed; //kept for the P-code of what the register machine can't run
+        int optLevel;
+        int inlineLimit;
+        //inlining is only done at -O2
+        void configure() {
+            codeGenerator.setTypeSpecialization(optLevel >= 1);
+            codeGenerator.setInlineLimit(optLevel >= 2 ? inlineLimit:0);
+        }
+        ASTNode* optimize(ASTNode* ast) {
+            if (optLevel >= 1)
+                ast = folder.fold(ast);
+            return ast;
+        }
     public:
         Compiler(bool trace = false) {
             astBuilder.setTrace(trace);
             codeGenerator.setTrace(trace);
+            regGenerator.setTrace(trace);
+            parsed = nullptr;
+            optLevel = 0;
+            inlineLimit = DEFAULT_INLINE_LIMIT;
+            configure();
         }
-        vector<Instruction> compile(string code) {
+        vector<Instruction>& compile(string code) {
             ASTNode* ast = astBuilder.build(code);
-            return codeGenerator.generate(ast);
+            folder.setPropagation(false);
+            return codeGenerator.generate(optimize(ast));
         }
-        vector<Instruction> compileFile(string filename) {
+        vector<Instruction>& compileFile(string filename) {
             ASTNode* ast = astBuilder.buildFromFile(filename);
-            return codeGenerator.generate(ast);
+            folder.setPropagation(true);
+            return codeGenerator.generate(optimize(ast));
+        }
+        //Returns what in the program the register machine can't run, if
+        //anything, in which case compileParsed() gives its P-code.
+        string compileFileToRegisters(string filename, RegProgram& program) {
+            parsed = astBuilder.buildFromFile(filename);
+            folder.setPropagation(true);
+            parsed = optimize(parsed);
+            return regGenerator.generate(parsed, program);
+        }
+        vector<Instruction>& compileParsed() {
+            return codeGenerator.generate(parsed);
+        }
+        //the extent of the globals and the heap the code was compiled for
+        int globalsEnd() {
+            return codeGenerator.globalsEnd();
+        }
+        int heapEnd() {
+            return codeGenerator.heapEnd();
         }
         void setTrace(bool trace) {
             astBuilder.setTrace(trace);
             codeGenerator.setTrace(trace);
+            regGenerator.setTrace(trace);
+        }
+        void setOptLevel(int level) {
+            optLevel = level;
+            configure();
+        }
+        void setInlineLimit(int limit) {
+            inlineLimit = limit;
+            configure();
+        }
+        void printStats() {
+            if (optLevel >= 1) {
+                folder.printStats();
+                codeGenerator.printTypeStats();
+            }
+            if (optLevel >= 2)
+                cout<<"Inlining: "<<codeGenerator.inlinedCount()<<" calls inlined."<<endl;
         }
 };
 
@@ -0,0 +1,298 @@
+#ifndef constfold_hpp
+#define constfold_hpp
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include "syntaxtree.hpp"
+#include "value.hpp"
+using namespace std;
+
+//Constant folding and propagation on the AST, run before code generation.
+//
+//Operators whose operands are all constants are evaluated with the same
+//Value operations the VM would use, so a folded expression has exactly the
+//value it would have had at runtime. A let whose initializer folds to a
+//constant has the uses after it replaced by that constant, as long as the
+//variable is declared only once in the program and nothing can assign to
+//it. An if or while whose condition folds to a boolean loses the branch
+//that can never run, unless that branch declares something.
+const int MAX_FOLDED_STRING = 1024;
+
+class ConstantFolder {
+    private:
+        int folded;
+        int propagated;
+        int branches;
+        bool propagate;
+        unordered_map<string, int> declarations;
+        unordered_set<string> assigned;
+        unordered_map<string, ASTNode*> procedures;
+        unordered_map<string, ASTNode*> constants; //lets seen so far on the current path
+        bool isStmt(ASTNode* node, StmtType type) {
+            return node != nullptr && node->nk == STMT_NODE && node->type.stmt == type;
+        }
+        bool isExpr(ASTNode* node, ExprType type) {
+            return node != nullptr && node->nk == EXPR_NODE && node->type.expr == type;
+        }
+        bool isConstant(ASTNode* node) {
+            return isExpr(node, CONST_EXPR) || isExpr(node, STR_EXPR);
+        }
+        Value valueOf(ASTNode* node) {
+            if (isExpr(node, STR_EXPR))
+                return makeString(node->data.strval);
+            return node->value;
+        }
+        //rewrites node in place, so whatever links to it is left intact
+        void makeConstant(ASTNode* node, Value val) {
+            node->data.strval = toStdString(val);
+            if (typeOf(val) == AS_STRING) {
+                node->type.expr = STR_EXPR;
+                node->data.symbol = TK_STR;
+            } else {
+                node->type.expr = CONST_EXPR;
+                node->data.symbol = TK_NUM;
+                node->value = val;
+            }
+            for (int i = 0; i < MAXCHILD; i++)
+                node->child[i] = nullptr;
+        }
+        bool declares(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (node->nk != STMT_NODE)
+                    continue;
+                switch (node->type.stmt) {
+                    case LET_STMT: case REF_STMT: case STRUCT_STMT: case FUNC_DEF_STMT:
+                        return true;
+                    default:
+                        break;
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    if (declares(node->child[i]))
+                        return true;
+            }
+            return false;
+        }
+        void findProcedures(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, FUNC_DEF_STMT))
+                    procedures[node->data.strval] = node;
+                for (int i = 0; i < MAXCHILD; i++)
+                    findProcedures(node->child[i]);
+            }
+        }
+        void markAssigned(ASTNode* target) {
+            if (isExpr(target, ID_EXPR))
+                assigned.insert(target->data.strval);
+        }
+        //an argument can only be assigned to by the callee when
+        //it is passed to a ref parameter.
+        void markRefArgs(ASTNode* call) {
+            auto it = procedures.find(call->data.strval);
+            ASTNode* param = it == procedures.end() ? nullptr:it->second->child[0];
+            for (ASTNode* arg = call->child[1]; arg != nullptr; arg = arg->next) {
+                if (it == procedures.end() || isStmt(param, REF_STMT))
+                    markAssigned(arg);
+                if (param != nullptr)
+                    param = param->next;
+            }
+        }
+        void findAssignments(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, LET_STMT) || isStmt(node, REF_STMT)) {
+                    declarations[node->data.strval]++;
+                    if (isStmt(node, REF_STMT) || isExpr(node->child[0], SUBSCRIPT_EXPR)) {
+                        assigned.insert(node->data.strval);
+                        markAssigned(node->child[0]);
+                    }
+                } else if (isExpr(node, ASSIGN_EXPR)) {
+                    markAssigned(node->child[0]);
+                } else if (isExpr(node, UNOP_EXPR) && (node->data.symbol == TK_POST_INC || node->data.symbol == TK_POST_DEC)) {
+                    markAssigned(node->child[0]);
+                } else if (isExpr(node, FUNC_EXPR)) {
+                    markRefArgs(node);
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    findAssignments(node->child[i]);
+            }
+        }
+        bool foldBinOp(ASTNode* node) {
+            Value lhs = valueOf(node->child[0]);
+            Value rhs = valueOf(node->child[1]);
+            Value result;
+            switch (node->data.symbol) {
+                case TK_ADD: result = Add(lhs, rhs); break;
+                case TK_SUB: result = Sub(lhs, rhs); break;
+                case TK_MUL: result = Mul(lhs, rhs); break;
+                case TK_DIV: {
+                    //left for the VM, which reports it
+                    if (isZero(rhs))
+                        return false;
+                    result = Div(lhs, rhs);
+                } break;
+                case TK_LT:  result = lt(lhs, rhs); break;
+                case TK_LTE: result = lte(lhs, rhs); break;
+                case TK_GT:  result = gt(lhs, rhs); break;
+                case TK_GTE: result = gte(lhs, rhs); break;
+                case TK_EQU: result = equ(lhs, rhs); break;
+                case TK_NEQ: result = neq(lhs, rhs); break;
+                default:
+                    return false;
+            }
+            if (typeOf(result) == AS_STRING && stringLength(result) > MAX_FOLDED_STRING)
+                return false;
+            makeConstant(node, result);
+            return true;
+        }
+        bool foldUnaryOp(ASTNode* node) {
+            switch (node->data.symbol) {
+                case TK_SUB: makeConstant(node, Neg(valueOf(node->child[0]))); return true;
+                case TK_NOT: makeConstant(node, Not(valueOf(node->child[0]))); return true;
+                default:
+                    break;
+            }
+            return false;
+        }
+        void foldExpr(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                switch (node->type.expr) {
+                    case ID_EXPR: {
+                        auto it = constants.find(node->data.strval);
+                        if (node->child[0] == nullptr && it != constants.end()) {
+                            makeConstant(node, valueOf(it->second));
+                            propagated++;
+                        } else {
+                            foldExpr(node->child[0]);
+                        }
+                    } break;
+                    case FIELD_EXPR:
+                    case BLESS_EXPR:
+                        break;
+                    case BINOP_EXPR:
+                    case RELOP_EXPR: {
+                        foldExpr(node->child[0]);
+                        foldExpr(node->child[1]);
+                        if (isConstant(node->child[0]) && isConstant(node->child[1]) && foldBinOp(node))
+                            folded++;
+                    } break;
+                    case UNOP_EXPR: {
+                        foldExpr(node->child[0]);
+                        if (isConstant(node->child[0]) && foldUnaryOp(node))
+                            folded++;
+                    } break;
+                    default: {
+                        for (int i = 0; i < MAXCHILD; i++)
+                            foldExpr(node->child[i]);
+                    } break;
+                }
+            }
+        }
+        bool isPropagatable(ASTNode* let) {
+            string name = let->data.strval;
+            return propagate && declarations[name] == 1 && assigned.count(name) == 0 && isConstant(let->child[0]);
+        }
+        //-1 if the condition isn't a constant boolean
+        int decided(ASTNode* cond) {
+            if (!isExpr(cond, CONST_EXPR) || typeOf(cond->value) != AS_BOOL)
+                return -1;
+            return getBoolean(cond->value) ? 1:0;
+        }
+        //returns what the statement is replaced by, which may be
+        //a whole list of statements or nothing at all.
+        ASTNode* foldStmt(ASTNode* node) {
+            switch (node->type.stmt) {
+                case PROGRAM_STMT:
+                case BLOCK_STMT: {
+                    node->child[0] = foldList(node->child[0]);
+                } break;
+                case LET_STMT: {
+                    if (!isExpr(node->child[0], SUBSCRIPT_EXPR))
+                        foldExpr(node->child[0]);
+                    if (isPropagatable(node))
+                        constants[node->data.strval] = node->child[0];
+                } break;
+                case PRINT_STMT:
+                case EXPR_STMT:
+                case RETURN_STMT: {
+                    foldExpr(node->child[0]);
+                } break;
+                case IF_STMT: {
+                    foldExpr(node->child[0]);
+                    int taken = decided(node->child[0]);
+                    ASTNode* dead = taken == 1 ? node->child[2]:node->child[1];
+                    if (taken != -1 && !declares(dead)) {
+                        branches++;
+                        return foldList(taken == 1 ? node->child[1]:node->child[2]);
+                    }
+                    node->child[1] = foldBlock(node->child[1]);
+                    node->child[2] = foldBlock(node->child[2]);
+                } break;
+                case WHILE_STMT: {
+                    foldExpr(node->child[0]);
+                    if (decided(node->child[0]) == 0 && !declares(node->child[1])) {
+                        branches++;
+                        return nullptr;
+                    }
+                    node->child[1] = foldBlock(node->child[1]);
+                } break;
+                //a procedure can be called before the lets that come
+                //ahead of it have run, so only its own are known
+                case FUNC_DEF_STMT: {
+                    auto saved = constants;
+                    constants.clear();
+                    node->child[1] = foldList(node->child[1]);
+                    constants = saved;
+                } break;
+                default:
+                    break;
+            }
+            return node;
+        }
+        ASTNode* foldList(ASTNode* list) {
+            ASTNode* head = nullptr;
+            ASTNode** link = &head;
+            while (list != nullptr) {
+                ASTNode* next = list->next;
+                list->next = nullptr;
+                *link = list->nk == STMT_NODE ? foldStmt(list):list;
+                while (*link != nullptr)
+                    link = &(*link)->next;
+                list = next;
+            }
+            return head;
+        }
+        //a let inside a conditional block is not known
+        //to have run once the block is left
+        ASTNode* foldBlock(ASTNode* list) {
+            auto saved = constants;
+            list = foldList(list);
+            constants = saved;
+            return list;
+        }
+    public:
+        ConstantFolder() {
+            folded = 0;
+            propagated = 0;
+            branches = 0;
+            propagate = true;
+        }
+        //Propagation needs to see every assignment in the program, which
+        //isn't the case for a line typed into the repl.
+        void setPropagation(bool enable) {
+            propagate = enable;
+        }
+        ASTNode* fold(ASTNode* ast) {
+            folded = propagated = branches = 0;
+            declarations.clear();
+            assigned.clear();
+            procedures.clear();
+            constants.clear();
+            findProcedures(ast);
+            findAssignments(ast);
+            return foldList(ast);
+        }
+        void printStats() {
+            cout<<"Constant folding: "<<folded<<" expressions folded, "<<propagated<<" constants propagated, "<<branches<<" dead branches removed."<<endl;
+        }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,329 @@
+#ifndef gc_hpp
+#define gc_hpp
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+const size_t DEFAULT_HEAP_LIMIT = 256 << 20;
+const size_t MIN_GC_THRESHOLD = 1 << 20; //bytes allocated before the first collection
+const int INTERN_MAX_LEN = 32; //longest string made at run time that is interned
+const int ROPE_MIN_LEN = 128;   //shortest concatenation made at run time that is a rope
+
+//Strings are immutable once made, so the hash is computed with them.
+//There is only one interned String with any given text.
+//
+//A concatenation made at run time is a rope: a String with no chars of
+//its own yet, only its two halves. StringHeap::flatten() gives it chars
+//and its hash the first time they are needed, and lets the halves go.
+struct String {
+    char* str;
+    int len;
+    uint32_t hash;
+    bool interned;
+    bool marked;
+    bool managed;
+    String* next; //the heap's list of the strings it manages
+    String* left; //a rope's halves
+    String* right;
+};
+
+//FNV-1a
+uint32_t hashBytes(const char* str, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++)
+        h = (h ^ (uint8_t)str[i]) * 16777619u;
+    return h;
+}
+
+bool sameText(const String* lhs, const String* rhs) {
+    return lhs->hash == rhs->hash && lhs->len == rhs->len && memcmp(lhs->str, rhs->str, lhs->len) == 0;
+}
+
+String* const REMOVED_STRING = (String*)1;
+
+//Open addressing with linear probing, on the hash each String carries.
+//A removed entry leaves a marker behind, which an insert may reuse,
+//until the table is rebuilt.
+class InternTable {
+    private:
+        vector<String*> slots;
+        int count;
+        int used; //entries and markers
+        void rebuild(int capacity) {
+            vector<String*> old = slots;
+            slots.assign(capacity, nullptr);
+            count = used = 0;
+            for (String* str : old) {
+                if (str != nullptr && str != REMOVED_STRING) {
+                    size_t at = probe(str);
+                    slots[at] = str;
+                    count++;
+                    used++;
+                }
+            }
+        }
+    public:
+        InternTable() {
+            slots.assign(1024, nullptr);
+            count = used = 0;
+        }
+        //the slot holding a string with key's text, or else the one to put it in
+        size_t probe(const String* key) {
+            size_t mask = slots.size()-1;
+            size_t free = slots.size();
+            size_t i = key->hash & mask;
+            for (; slots[i] != nullptr; i = (i+1) & mask) {
+                if (slots[i] == REMOVED_STRING) {
+                    if (free == slots.size())
+                        free = i;
+                } else if (sameText(slots[i], key)) {
+                    return i;
+                }
+            }
+            return free == slots.size() ? i:free;
+        }
+        String* at(size_t slot) {
+            return slots[slot] == REMOVED_STRING ? nullptr:slots[slot];
+        }
+        //into the slot probe() gave for it, may rebuild the table
+        void insert(size_t slot, String* str) {
+            if (slots[slot] == nullptr)
+                used++;
+            slots[slot] = str;
+            count++;
+            if (2*used > slots.size())
+                rebuild(4*count > slots.size() ? 2*slots.size():slots.size());
+        }
+        void remove(String* str) {
+            size_t mask = slots.size()-1;
+            for (size_t i = str->hash & mask; slots[i] != nullptr; i = (i+1) & mask) {
+                if (slots[i] == str) {
+                    slots[i] = REMOVED_STRING;
+                    count--;
+                    return;
+                }
+            }
+        }
+};
+
+//Strings made while a program runs are managed by a precise mark-sweep
+//collector. Those made before, by the compiler, are left alone, they
+//live in the code and the compiler's own structures. A collection marks
+//the strings the VM's roots point to, and the halves of those that are
+//ropes, then a sweep frees every managed string left unmarked.
+//
+//The interning table holds every string the compiler makes, so literals
+//with the same text share one String, and the short strings made at run
+//time. It doesn't keep them alive: the sweep takes the ones it frees out.
+//
+//Allocation never collects, it only counts the bytes towards the next
+//collection. The VM collects at points where every string it still uses
+//is reachable from its roots, once wantsCollection() says to.
+class StringHeap {
+    private:
+        String* objects;
+        InternTable interned;
+        bool managing;
+        size_t bytes;     //in managed strings, live or not
+        size_t nextCollection;
+        size_t limit;
+        int collections;
+        size_t freed;
+        double totalPause; //in microseconds
+        double maxPause;
+        chrono::steady_clock::time_point started;
+        vector<String*> work; //for marking and flattening ropes without recursion
+        size_t sizeOf(String* str) {
+            return sizeof(String) + (str->str == nullptr ? 0:str->len + 1);
+        }
+        String* newString(char* chars, int len) {
+            String* ns = new String;
+            ns->str = chars;
+            ns->len = len;
+            ns->hash = 0;
+            ns->interned = false;
+            ns->marked = false;
+            ns->managed = managing;
+            ns->next = nullptr;
+            ns->left = ns->right = nullptr;
+            if (managing) {
+                ns->next = objects;
+                objects = ns;
+                bytes += sizeOf(ns);
+            }
+            return ns;
+        }
+    public:
+        StringHeap() {
+            objects = nullptr;
+            managing = false;
+            bytes = 0;
+            limit = DEFAULT_HEAP_LIMIT;
+            nextCollection = MIN_GC_THRESHOLD;
+            collections = 0;
+            freed = 0;
+            totalPause = 0;
+            maxPause = 0;
+        }
+        //str holds len+1 chars, the caller fills them in and then seals it
+        String* allocate(int len) {
+            return newString(new char[len+1], len);
+        }
+        void seal(String* str) {
+            str->str[str->len] = '\0';
+            str->hash = hashBytes(str->str, str->len);
+        }
+        //the String with this text, made if there isn't one
+        String* intern(const char* str, int len) {
+            String key;
+            key.str = (char*)str;
+            key.len = len;
+            key.hash = hashBytes(str, len);
+            size_t slot = interned.probe(&key);
+            String* found = interned.at(slot);
+            if (found != nullptr)
+                return found;
+            String* ns = allocate(len);
+            memcpy(ns->str, str, len);
+            ns->str[len] = '\0';
+            ns->hash = key.hash;
+            ns->interned = true;
+            interned.insert(slot, ns);
+            return ns;
+        }
+        //everything the compiler makes is interned, at run time only short strings are
+        String* make(const char* str, int len) {
+            if (!managing || len <= INTERN_MAX_LEN)
+                return intern(str, len);
+            String* ns = allocate(len);
+            memcpy(ns->str, str, len);
+            seal(ns);
+            return ns;
+        }
+        //lhs + rhs, a rope if it is long enough for copying to matter
+        String* concat(String* lhs, String* rhs) {
+            int len = lhs->len + rhs->len;
+            if (managing && len >= ROPE_MIN_LEN && lhs->len > 0 && rhs->len > 0) {
+                String* rope = newString(nullptr, len);
+                rope->left = lhs;
+                rope->right = rhs;
+                return rope;
+            }
+            flatten(lhs);
+            flatten(rhs);
+            if (!managing || len <= INTERN_MAX_LEN) {
+                string text(lhs->str, lhs->len);
+                text.append(rhs->str, rhs->len);
+                return intern(text.data(), len);
+            }
+            String* ns = allocate(len);
+            memcpy(ns->str, lhs->str, lhs->len);
+            memcpy(ns->str + lhs->len, rhs->str, rhs->len);
+            seal(ns);
+            return ns;
+        }
+        //copies the chars of a rope's leaves, left to right, into its own
+        void flatten(String* str) {
+            if (str->str != nullptr)
+                return;
+            char* chars = new char[str->len+1];
+            int at = 0;
+            work.push_back(str);
+            while (!work.empty()) {
+                String* part = work.back();
+                work.pop_back();
+                if (part->str != nullptr) {
+                    memcpy(chars + at, part->str, part->len);
+                    at += part->len;
+                } else {
+                    work.push_back(part->right);
+                    work.push_back(part->left);
+                }
+            }
+            str->str = chars;
+            str->left = str->right = nullptr;
+            seal(str);
+            if (str->managed)
+                bytes += str->len + 1;
+        }
+        void setManaged(bool manage) {
+            managing = manage;
+        }
+        void setLimit(size_t maxBytes) {
+            limit = maxBytes;
+            nextCollection = min(nextCollection, limit);
+        }
+        inline bool wantsCollection() {
+            return bytes >= nextCollection;
+        }
+        void beginCollection() {
+            started = chrono::steady_clock::now();
+        }
+        void mark(String* str) {
+            if (str->marked)
+                return;
+            str->marked = true;
+            if (str->left == nullptr)
+                return;
+            work.push_back(str);
+            while (!work.empty()) {
+                String* rope = work.back();
+                work.pop_back();
+                for (String* half : { rope->left, rope->right }) {
+                    if (!half->marked) {
+                        half->marked = true;
+                        if (half->left != nullptr)
+                            work.push_back(half);
+                    }
+                }
+            }
+        }
+        //the next collection comes once as many bytes again as survived
+        //this one have been allocated, but before the heap outgrows its limit
+        void sweep() {
+            String** link = &objects;
+            while (*link != nullptr) {
+                String* str = *link;
+                if (str->marked) {
+                    str->marked = false;
+                    link = &str->next;
+                } else {
+                    *link = str->next;
+                    size_t size = sizeOf(str);
+                    bytes -= size;
+                    freed += size;
+                    if (str->interned)
+                        interned.remove(str);
+                    delete [] str->str;
+                    delete str;
+                }
+            }
+            if (bytes > limit) {
+                cout<<"Error: out of memory, "<<bytes<<" bytes of strings in use, the limit is "<<limit<<endl;
+                exit(EXIT_FAILURE);
+            }
+            nextCollection = min(limit, bytes + max(bytes, MIN_GC_THRESHOLD));
+            double pause = chrono::duration<double, micro>(chrono::steady_clock::now() - started).count();
+            totalPause += pause;
+            maxPause = max(maxPause, pause);
+            collections++;
+        }
+        size_t bytesInUse() {
+            return bytes;
+        }
+        void printStats() {
+            if (collections == 0)
+                return;
+            cout<<"GC: "<<collections<<" collections, "<<freed<<" bytes freed, "<<bytes<<" bytes in use, ";
+            cout<<fixed<<setprecision(3)<<totalPause/1000<<" ms paused, "<<maxPause/1000<<" ms the longest."<<defaultfloat<<setprecision(6)<<endl;
+        }
+};
+
+StringHeap stringHeap;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+#ifndef inliner_hpp
+#define inliner_hpp
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include "syntaxtree.hpp"
+using namespace std;
+
+//Decides which procedure calls PCodeGenerator expands in place.
+//
+//A procedure can be inlined when its body is at most the size limit in
+//AST nodes, it calls nothing (so it can't recurse), has no ref parameters
+//and declares nothing but initialized scalar lets. What a procedure
+//returns is whatever is on top of the stack at its RET, so the body must
+//also have a known stack effect: it leaves exactly one value, which is
+//the result, or none, in which case the result is its last parameter,
+//the top slot of its frame. A let counts as leaving its value.
+const int DEFAULT_INLINE_LIMIT = 20;
+const int UNKNOWN_EFFECT = -1;
+
+struct InlineProc {
+    ASTNode* def;
+    vector<string> vars;    //parameters then locals, in frame order
+    vector<string> zeroed;  //locals which may be read before their let
+    int numParams;
+    int stackEffect;
+    bool owns(string name) {
+        for (string& v : vars)
+            if (v == name)
+                return true;
+        return false;
+    }
+};
+
+class InlineAnalyzer {
+    private:
+        int limit;
+        unordered_map<string, int> definitions;
+        unordered_map<string, InlineProc> procs;
+        bool isStmt(ASTNode* node, StmtType type) {
+            return node != nullptr && node->nk == STMT_NODE && node->type.stmt == type;
+        }
+        bool isExpr(ASTNode* node, ExprType type) {
+            return node != nullptr && node->nk == EXPR_NODE && node->type.expr == type;
+        }
+        bool isUpdate(ASTNode* node) {
+            return isExpr(node, ASSIGN_EXPR) || (isExpr(node, UNOP_EXPR) &&
+                  (node->data.symbol == TK_POST_INC || node->data.symbol == TK_POST_DEC));
+        }
+        int size(ASTNode* node) {
+            int count = 0;
+            for (; node != nullptr; node = node->next) {
+                count++;
+                for (int i = 0; i < MAXCHILD; i++)
+                    count += size(node->child[i]);
+            }
+            return count;
+        }
+        //assignments only appear as statements, everything else that
+        //could need a frame or a call of its own is refused
+        bool isSimple(ASTNode* node, bool statementLevel) {
+            for (; node != nullptr; node = node->next) {
+                if (node->nk == STMT_NODE) {
+                    switch (node->type.stmt) {
+                        case LET_STMT:
+                            if (node->child[0] == nullptr || isExpr(node->child[0], SUBSCRIPT_EXPR) || isExpr(node->child[0], BLESS_EXPR))
+                                return false;
+                            break;
+                        case PRINT_STMT: case EXPR_STMT: case RETURN_STMT:
+                        case IF_STMT: case WHILE_STMT:
+                            break;
+                        default:
+                            return false;
+                    }
+                    if (!isSimple(node->child[0], isStmt(node, EXPR_STMT)))
+                        return false;
+                    for (int i = 1; i < MAXCHILD; i++)
+                        if (!isSimple(node->child[i], false))
+                            return false;
+                    continue;
+                }
+                switch (node->type.expr) {
+                    case FUNC_EXPR: case FIELD_EXPR: case BLESS_EXPR:
+                        return false;
+                    default:
+                        break;
+                }
+                if (isUpdate(node) && !statementLevel)
+                    return false;
+                for (int i = 0; i < MAXCHILD; i++)
+                    if (!isSimple(node->child[i], false))
+                        return false;
+            }
+            return true;
+        }
+        //values each statement leaves on the stack as the code generator emits it
+        int stackEffect(ASTNode* list) {
+            int total = 0;
+            for (ASTNode* node = list; node != nullptr; node = node->next) {
+                int effect = 0;
+                switch (node->type.stmt) {
+                    case PRINT_STMT:
+                        effect = 0;
+                        break;
+                    case LET_STMT: case RETURN_STMT:
+                        effect = 1;
+                        break;
+                    case EXPR_STMT:
+                        effect = isUpdate(node->child[0]) ? 0:1;
+                        break;
+                    case IF_STMT: {
+                        effect = stackEffect(node->child[1]);
+                        if (effect != stackEffect(node->child[2]))
+                            effect = UNKNOWN_EFFECT;
+                    } break;
+                    case WHILE_STMT:
+                        effect = stackEffect(node->child[1]) == 0 ? 0:UNKNOWN_EFFECT;
+                        break;
+                    default:
+                        effect = UNKNOWN_EFFECT;
+                        break;
+                }
+                if (effect == UNKNOWN_EFFECT)
+                    return UNKNOWN_EFFECT;
+                total += effect;
+            }
+            return total;
+        }
+        bool mentions(ASTNode* node, string& name) {
+            for (; node != nullptr; node = node->next) {
+                if ((isExpr(node, ID_EXPR) || isStmt(node, LET_STMT)) && node->data.strval == name)
+                    return true;
+                for (int i = 0; i < MAXCHILD; i++)
+                    if (mentions(node->child[i], name))
+                        return true;
+            }
+            return false;
+        }
+        //A local needs clearing, as INC would on a real call, unless the
+        //first statement of the body to mention it is its own let.
+        bool readBeforeLet(ASTNode* body, string& name) {
+            for (ASTNode* node = body; node != nullptr; node = node->next) {
+                ASTNode* next = node->next;
+                node->next = nullptr;
+                bool found = mentions(node, name);
+                node->next = next;
+                if (found)
+                    return !(isStmt(node, LET_STMT) && node->data.strval == name && !mentions(node->child[0], name));
+            }
+            return true;
+        }
+        void collectLets(ASTNode* node, vector<string>& vars) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, LET_STMT)) {
+                    bool seen = false;
+                    for (string& v : vars)
+                        if (v == node->data.strval)
+                            seen = true;
+                    if (!seen)
+                        vars.push_back(node->data.strval);
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    collectLets(node->child[i], vars);
+            }
+        }
+        void findProcedures(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, FUNC_DEF_STMT)) {
+                    definitions[node->data.strval]++;
+                    consider(node);
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    findProcedures(node->child[i]);
+            }
+        }
+        void consider(ASTNode* def) {
+            ASTNode* body = def->child[1];
+            InlineProc proc;
+            proc.def = def;
+            proc.numParams = 0;
+            for (ASTNode* p = def->child[0]; p != nullptr; p = p->next) {
+                if (!isStmt(p, LET_STMT))
+                    return;
+                proc.vars.push_back(p->data.strval);
+                proc.numParams++;
+            }
+            if (size(body) > limit || !isSimple(body, false))
+                return;
+            proc.stackEffect = stackEffect(body);
+            if (proc.stackEffect != 0 && proc.stackEffect != 1)
+                return;
+            collectLets(body, proc.vars);
+            if (proc.stackEffect == 0 && proc.numParams == 0)
+                return;
+            for (int i = proc.numParams; i < proc.vars.size(); i++)
+                if (readBeforeLet(body, proc.vars[i]))
+                    proc.zeroed.push_back(proc.vars[i]);
+            procs[def->data.strval] = proc;
+        }
+    public:
+        InlineAnalyzer(int sizeLimit = DEFAULT_INLINE_LIMIT) {
+            limit = sizeLimit;
+        }
+        void setLimit(int sizeLimit) {
+            limit = sizeLimit;
+        }
+        void analyze(ASTNode* ast) {
+            definitions.clear();
+            procs.clear();
+            if (limit > 0)
+                findProcedures(ast);
+        }
+        //the procedure a call can be replaced by, or nullptr
+        InlineProc* inlinable(ASTNode* call) {
+            auto it = procs.find(call->data.strval);
+            if (it == procs.end() || definitions[call->data.strval] != 1)
+                return nullptr;
+            int args = 0;
+            for (ASTNode* t = call->child[1]; t != nullptr; t = t->next)
+                args++;
+            return args == it->second.numParams ? &it->second:nullptr;
+        }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,937 @@
+#ifndef jit_hpp
+#define jit_hpp
+
+//The JIT emits x86-64 for the tagged union Value, on Linux for mmap.
+//Anywhere else, or with NaN boxing, everything is interpreted.
+#if defined(__x86_64__) && defined(__linux__) && !defined(DALGOL_NAN_BOXING) && !defined(DALGOL_NO_JIT)
+#define DALGOL_JIT
+#endif
+
+#ifdef DALGOL_JIT
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include "value.hpp"
+#include "vminst.hpp"
+#include "memory_layout.hpp"
+#include "x64asm.hpp"
+using namespace std;
+
+static_assert(sizeof(Value) == 16 && offsetof(Value, intval) == 8, "the JIT's templates assume a 16 byte Value with its payload at 8");
+static_assert(offsetof(Value, smallLen) == 4, "the JIT's string compare assumes smallLen follows the type");
+
+//The state native code and the interpreter hand back and forth. sp, bp
+//and stackTop are byte offsets into stack rather than slot numbers,
+//which is how the native code indexes it.
+struct JitContext {
+    Value* stack;
+    int64_t sp;
+    int64_t bp;
+    int64_t stackTop;
+    Value* globals;
+    int64_t globalsSize;
+    int* display;
+    int64_t ip;     //where the interpreter carries on
+    void* vm;
+    void* jit;
+};
+
+//what native code returns to the interpreter
+enum JitStatus {
+    JIT_RETURNED, JIT_EXITED, JIT_HALTED
+};
+
+//Runtime helpers the VM provides: one runs the single instruction at
+//ip and returns whether it branched, the other grows the stack to sp.
+typedef int (*JitStepFn)(JitContext*, int);
+
+const int JIT_HOT_COUNT = 50;          //calls, tail calls and loop back edges before a procedure is compiled
+const int JIT_MAX_NATIVE_DEPTH = 10000; //deeper recursion carries on in the interpreter
+const size_t JIT_ARENA_SIZE = 16 << 20;
+
+//A procedure, from where it is called to its RET, or the main program,
+//which is everything outside of procedures.
+struct JitUnit {
+    int start;
+    int depth;  //lexical level, -1 for the main program
+    int count;
+    bool failed;
+    uint8_t* entry;
+    JitUnit(int s = 0, int d = -1) : start(s), depth(d), count(0), failed(false), entry(nullptr) { }
+};
+
+//Baseline template JIT for the P-machine. Hot procedures are translated
+//instruction by instruction, each P-code instruction becoming a fixed
+//sequence of machine code working on the VM's own stack, so that at any
+//instruction boundary native code can hand over to the interpreter just
+//by saying where it got to. Integer arithmetic, comparisons, loads,
+//stores, calls and branches have native fast paths, anything else and
+//any operand which isn't an int goes back into the VM for one
+//instruction. Native code keeps the context in rbx, the stack in r12,
+//sp in r13, bp in r14, the display in r15, the VM's stackTop in r11
+//and how many native calls deep it is in rbp.
+class TemplateJit {
+    private:
+        vector<VMInstruction>* code;
+        vector<Value>* constants;
+        vector<int> owner;
+        vector<JitUnit> units;
+        vector<uint8_t*> nativeAt;
+        uint8_t* arena;
+        size_t used;
+        size_t trampolineSize;
+        int (*trampoline)(JitContext*, uint8_t*);
+        JitStepFn step;
+        JitStepFn grow;
+        int numCompiled;
+        int numFailed;
+        //the unit being translated
+        X64Assembler as;
+        int unit;
+        int here;
+        vector<bool> targets;
+        vector<bool> ownFrame;
+        vector<int> labels;
+        vector<pair<int,int>> branches; //rel32 to patch, target ip
+        vector<function<void()>> stubs; //out of line slow paths
+        //The peephole pass drops ENT, so procedures are found from the
+        //calls to them instead: one starts at a CAL's target, which gives
+        //its depth, and ends at the first RET back out of that depth.
+        //Anything else is the main program's.
+        void findUnits() {
+            vector<int> depthAt(code->size(), -1);
+            for (VMInstruction& inst : *code)
+                if (inst.instruction == CAL && inst.operand >= 0 && inst.operand < code->size())
+                    depthAt[inst.operand] = inst.nestlevel;
+            owner.assign(code->size(), 0);
+            units.clear();
+            units.push_back(JitUnit(0, -1));
+            vector<int> open;
+            for (int at = 0; at < code->size(); at++) {
+                if (depthAt[at] >= 0) {
+                    units.push_back(JitUnit(at, depthAt[at]));
+                    open.push_back(units.size()-1);
+                }
+                owner[at] = open.empty() ? 0:open.back();
+                VMInstruction& inst = (*code)[at];
+                if (inst.instruction == RET && !open.empty() && inst.nestlevel == units[open.back()].depth)
+                    open.pop_back();
+            }
+        }
+        bool isUnitStart(int at) {
+            return at >= 0 && at < code->size() && units[owner[at]].start == at && owner[at] != 0;
+        }
+        X64Mem ctx(size_t field) {
+            return X64Mem(RBX, NO_INDEX, field);
+        }
+        X64Mem slot(int below, int field = 0) {
+            return X64Mem(R12, R13, -16*below + field);
+        }
+        X64Mem frameSlot(int n, int field = 0) {
+            return X64Mem(R12, R14, 16*n + field);
+        }
+        X64Mem displayAt(int depth) {
+            return X64Mem(R15, NO_INDEX, depth*4);
+        }
+        //the VM works from the context while a helper runs, and may
+        //have moved the stack by the time it returns
+        void callHelper(void* fn, int arg) {
+            as.mov(ctx(offsetof(JitContext, sp)), R13);
+            as.mov(ctx(offsetof(JitContext, bp)), R14);
+            as.mov(RDI, RBX);
+            as.movImm32(RSI, arg);
+            as.movImm64(RAX, (int64_t)fn);
+            as.aluImm(ALU_SUB, RSP, 8);
+            as.call(RAX);
+            as.aluImm(ALU_ADD, RSP, 8);
+            as.mov(R12, ctx(offsetof(JitContext, stack)));
+            as.mov(R13, ctx(offsetof(JitContext, sp)));
+            as.mov(R14, ctx(offsetof(JitContext, bp)));
+            as.mov(R11, ctx(offsetof(JitContext, stackTop)));
+        }
+        //sp and bp are stored by the trampoline on the way out
+        void exitTo(int at, JitStatus status) {
+            as.movImm64(ctx(offsetof(JitContext, ip)), at);
+            as.movImm32(RAX, status);
+            as.ret();
+        }
+        //jumps, from each of the rel32s in from, to where the interpreter
+        //carries on at ip
+        void exitStub(vector<int> from, int at) {
+            stubs.push_back([=]() {
+                for (int j : from)
+                    as.patch(j, as.size());
+                exitTo(at, JIT_EXITED);
+            });
+        }
+        //the rest of the instruction at ip is done by the VM, after
+        //undoing pushed bytes of what the fast path did
+        void slowPath(vector<int> from, int at, int pushed = 0, bool branching = false) {
+            int resume = as.size();
+            stubs.push_back([=]() {
+                for (int j : from)
+                    as.patch(j, as.size());
+                if (pushed > 0)
+                    as.aluImm(ALU_SUB, R13, pushed);
+                callHelper((void*)step, at);
+                if (branching) {
+                    as.test32(RAX, RAX);
+                    jumpTo(as.jcc(CC_NE), (*code)[at].operand);
+                }
+                as.patch(as.jmp(), resume);
+            });
+        }
+        void jumpTo(int rel, int target) {
+            if (target < 0 || target >= code->size() || owner[target] != unit)
+                exitStub({rel}, target);
+            else
+                branches.push_back(make_pair(rel, target));
+        }
+        //for pushes of above bytes more than sp has moved, which a fused
+        //sequence makes and pops again
+        void growCheck(int above = 0) {
+            if (above > 0) {
+                as.lea(RAX, X64Mem(R13, NO_INDEX, above));
+                as.alu(ALU_CMP, RAX, R11);
+            } else {
+                as.alu(ALU_CMP, R13, R11);
+            }
+            int j = as.jcc(CC_G);
+            int resume = as.size();
+            stubs.push_back([=]() {
+                as.patch(j, as.size());
+                if (above > 0)
+                    as.aluImm(ALU_ADD, R13, above);
+                callHelper((void*)grow, 0);
+                if (above > 0)
+                    as.aluImm(ALU_SUB, R13, above);
+                as.patch(as.jmp(), resume);
+            });
+        }
+        void push() {
+            as.aluImm(ALU_ADD, R13, 16);
+            growCheck();
+        }
+        //Values are written and read as two quadwords, a wider load
+        //than the store it reads from would stall
+        void loadValue(X64Mem src) {
+            as.mov(R8, src);
+            as.mov(R9, src.offset(8));
+        }
+        void storeValue(X64Mem dst) {
+            as.mov(dst, R8);
+            as.mov(dst.offset(8), R9);
+        }
+        void storeInt(X64Mem m, X64Reg r) {
+            as.movImm64(m, AS_INT);
+            as.mov(m.offset(8), r);
+        }
+        //the payload is zero filled, as makeInt() leaves it
+        void storeInt(X64Mem m, int32_t n) {
+            as.movImm64(m, AS_INT);
+            if (n >= 0) {
+                as.movImm64(m.offset(8), n);
+            } else {
+                as.movImm32(m.offset(8), n);
+                as.movImm32(m.offset(12), 0);
+            }
+        }
+        //bp is the unit's own frame wherever no MST is waiting for its
+        //CAL. Should a branch land where one is, the unit's variables are
+        //all found through the display.
+        void findOwnFrame() {
+            ownFrame.assign(code->size(), false);
+            if (units[unit].depth < 0)
+                return;
+            int waiting = 0;
+            for (int at = units[unit].start; at < code->size(); at++) {
+                if (owner[at] != unit)
+                    continue;
+                if (targets[at] && waiting != 0) {
+                    ownFrame.assign(code->size(), false);
+                    return;
+                }
+                ownFrame[at] = waiting == 0;
+                if ((*code)[at].instruction == MST)
+                    waiting++;
+                else if ((*code)[at].instruction == CAL)
+                    waiting--;
+            }
+        }
+        void findTargets() {
+            targets.assign(code->size(), false);
+            for (int at = units[unit].start; at < code->size(); at++) {
+                VMInstruction& inst = (*code)[at];
+                if (owner[at] == unit && isBranchInst((Inst)inst.instruction) && inst.operand >= 0 && inst.operand < code->size())
+                    targets[inst.operand] = true;
+            }
+        }
+        bool inOwnFrame(VMInstruction& inst) {
+            return ownFrame[here] && inst.nestlevel == units[unit].depth;
+        }
+        //the operand of a LOD and the like, which isn't on the heap. rcx
+        //may be used for its base.
+        void variable(VMInstruction& inst, X64Mem& m) {
+            int addr = inst.operand;
+            if (isGlobalAddr(addr)) {
+                as.mov(RCX, ctx(offsetof(JitContext, globals)));
+                m = X64Mem(RCX, NO_INDEX, (addr - GLOBAL_BASE)*16);
+            } else if (inOwnFrame(inst)) {
+                m = frameSlot(SF_SLOTS + addr);
+            } else {
+                as.movsxd(RCX, displayAt(inst.nestlevel));
+                as.shl(RCX, 4);
+                m = X64Mem(R12, RCX, (SF_SLOTS + addr)*16);
+            }
+        }
+        //rax holds an address computed at run time, as memoryAt() takes
+        //it, leaves a pointer to its slot in rcx. Addresses outside of
+        //the stack and globals jump to slow.
+        void resolveAddress(vector<int>& slow) {
+            as.mov(RCX, RAX);
+            as.aluImm(ALU_SUB, RCX, GLOBAL_BASE);
+            as.alu(ALU_CMP, RCX, ctx(offsetof(JitContext, globalsSize)));
+            int notGlobal = as.jcc(CC_AE);
+            as.shl(RCX, 4);
+            as.alu(ALU_ADD, RCX, ctx(offsetof(JitContext, globals)));
+            int done = as.jmp();
+            as.patch(notGlobal, as.size());
+            as.test(RAX, RAX);
+            slow.push_back(as.jcc(CC_S));
+            as.shl(RAX, 4);
+            as.alu(ALU_CMP, RAX, ctx(offsetof(JitContext, stackTop)));
+            slow.push_back(as.jcc(CC_G));
+            as.lea(RCX, X64Mem(R12, RAX, 0));
+            as.patch(done, as.size());
+        }
+        void checkInt(X64Mem m, vector<int>& slow) {
+            as.cmp32(m, AS_INT);
+            slow.push_back(as.jcc(CC_NE));
+        }
+        X64Cond conditionOf(int inst) {
+            switch (inst) {
+                case EQU: case NEQU: case EQUJ: case NEQUJ: return CC_E;
+                case NEQ: case NNEQ: case NEQJ: case NNEQJ: return CC_NE;
+                case LTE: case NLTE: case LTEJ: case NLTEJ: return CC_LE;
+                case GTE: case NGTE: case GTEJ: case NGTEJ: return CC_GE;
+                case LT:  case NLT:  case LTJ:  case NLTJ:  return CC_L;
+                default: break;
+            }
+            return CC_G;
+        }
+        void arithmetic(int at, int inst) {
+            vector<int> slow;
+            checkInt(slot(1), slow);
+            checkInt(slot(0), slow);
+            as.mov32(RAX, slot(1, 8));
+            switch (inst) {
+                case ADD: case NADD: as.alu(ALU_ADD, RAX, slot(0, 8), false); break;
+                case SUB: case NSUB: as.alu(ALU_SUB, RAX, slot(0, 8), false); break;
+                default: as.imul32(RAX, slot(0, 8)); break;
+            }
+            slow.push_back(as.jcc(CC_O));
+            as.aluImm(ALU_SUB, R13, 16);
+            as.mov(slot(0, 8), RAX);
+            slowPath(slow, at);
+        }
+        void comparison(int at, int inst) {
+            vector<int> slow;
+            checkInt(slot(1), slow);
+            checkInt(slot(0), slow);
+            as.mov32(RAX, slot(1, 8));
+            as.alu(ALU_CMP, RAX, slot(0, 8), false);
+            as.setccEax(conditionOf(inst));
+            as.aluImm(ALU_SUB, R13, 16);
+            as.movImm64(slot(0), AS_BOOL);
+            as.mov(slot(0, 8), RAX);
+            slowPath(slow, at);
+        }
+        //lea and mov leave the flags of the compare alone
+        void compareAndBranch(int at, int inst) {
+            vector<int> slow;
+            checkInt(slot(1), slow);
+            checkInt(slot(0), slow);
+            as.mov32(RAX, slot(1, 8));
+            as.alu(ALU_CMP, RAX, slot(0, 8), false);
+            popOperands();
+            jumpTo(as.jcc((X64Cond)(conditionOf(inst) ^ 1)), (*code)[at].operand);
+            if (inst == EQUJ || inst == NEQJ)
+                compareStrings(slow, at, inst);
+            else
+                slowPath(slow, at, 0, true);
+        }
+        //Two small strings are equal only if their lengths and payloads
+        //are, a small string never equals a String, and two interned
+        //strings are equal only if they are the same String, so EQUJ and
+        //NEQJ decide those without leaving native code. Any other
+        //operands go on to the slow path.
+        void compareStrings(vector<int> from, int at, int inst) {
+            int resume = as.size();
+            stubs.push_back([=]() {
+                for (int j : from)
+                    as.patch(j, as.size());
+                vector<int> slow;
+                as.cmp32(slot(1), AS_STRING);
+                slow.push_back(as.jcc(CC_NE));
+                as.cmp32(slot(0), AS_STRING);
+                slow.push_back(as.jcc(CC_NE));
+                vector<int> differ;
+                as.mov32(RDX, slot(1, offsetof(Value, smallLen)));
+                as.alu(ALU_CMP, RDX, slot(0, offsetof(Value, smallLen)), false);
+                differ.push_back(as.jcc(CC_NE));
+                as.mov(RAX, slot(1, 8));
+                as.mov(RCX, slot(0, 8));
+                as.alu(ALU_CMP, RAX, RCX);
+                int same = as.jcc(CC_E);
+                as.test32(RDX, RDX);
+                differ.push_back(as.jcc(CC_NE));
+                as.movzx8(RDX, X64Mem(RAX, NO_INDEX, offsetof(String, interned)));
+                as.movzx8(R8, X64Mem(RCX, NO_INDEX, offsetof(String, interned)));
+                as.test32(RDX, RDX);
+                slow.push_back(as.jcc(CC_E));
+                as.test32(R8, R8);
+                slow.push_back(as.jcc(CC_E));
+                for (int j : differ)
+                    as.patch(j, as.size());
+                popOperands();
+                if (inst == EQUJ)
+                    jumpTo(as.jmp(), (*code)[at].operand);
+                else
+                    as.patch(as.jmp(), resume);
+                as.patch(same, as.size());
+                popOperands();
+                if (inst == EQUJ)
+                    as.patch(as.jmp(), resume);
+                else
+                    jumpTo(as.jmp(), (*code)[at].operand);
+                for (int j : slow)
+                    as.patch(j, as.size());
+                callHelper((void*)step, at);
+                as.test32(RAX, RAX);
+                jumpTo(as.jcc(CC_NE), (*code)[at].operand);
+                as.patch(as.jmp(), resume);
+            });
+        }
+        //as compareAndBranch leaves the stack
+        void popOperands() {
+            as.lea(R13, X64Mem(R13, NO_INDEX, -32));
+            as.movImm64(slot(-1), AS_INT);
+            as.movImm64(slot(-1, 8), 0);
+        }
+        void updateVariable(int at, VMInstruction& inst) {
+            vector<int> slow;
+            X64Mem m(RAX);
+            variable(inst, m);
+            checkInt(m, slow);
+            as.mov32(RAX, m.offset(8));
+            as.aluImm(inst.instruction == INCV ? ALU_ADD:ALU_SUB, RAX, inst.aux, false);
+            slow.push_back(as.jcc(CC_O));
+            as.mov(m.offset(8), RAX);
+            slowPath(slow, at);
+        }
+        void loadAndApplyConstant(int at, VMInstruction& inst) {
+            vector<int> slow;
+            push();
+            X64Mem m(RAX);
+            variable(inst, m);
+            checkInt(m, slow);
+            as.mov32(RAX, m.offset(8));
+            as.aluImm(inst.instruction == LADD ? ALU_ADD:ALU_SUB, RAX, inst.aux, false);
+            slow.push_back(as.jcc(CC_O));
+            storeInt(slot(0), RAX);
+            slowPath(slow, at, 16);
+        }
+        void applyConstant(int at, VMInstruction& inst) {
+            vector<int> slow;
+            checkInt(slot(0), slow);
+            as.mov32(RAX, slot(0, 8));
+            switch (inst.instruction) {
+                case ADDC: as.aluImm(ALU_ADD, RAX, inst.operand, false); break;
+                case SUBC: as.aluImm(ALU_SUB, RAX, inst.operand, false); break;
+                default: as.imul32(RAX, RAX, inst.operand); break;
+            }
+            slow.push_back(as.jcc(CC_O));
+            as.mov(slot(0, 8), RAX);
+            slowPath(slow, at);
+        }
+        void applyVariable(int at, VMInstruction& inst) {
+            vector<int> slow;
+            X64Mem m(RAX);
+            variable(inst, m);
+            checkInt(slot(0), slow);
+            checkInt(m, slow);
+            as.mov32(RAX, slot(0, 8));
+            switch (inst.instruction) {
+                case ADDL: as.alu(ALU_ADD, RAX, m.offset(8), false); break;
+                case SUBL: as.alu(ALU_SUB, RAX, m.offset(8), false); break;
+                default: as.imul32(RAX, m.offset(8)); break;
+            }
+            slow.push_back(as.jcc(CC_O));
+            as.mov(slot(0, 8), RAX);
+            slowPath(slow, at);
+        }
+        void loadAddress(VMInstruction& inst) {
+            push();
+            if (!isStackAddr(inst.operand)) {
+                storeInt(slot(0), inst.operand);
+                return;
+            }
+            if (inOwnFrame(inst)) {
+                as.mov(RAX, R14);
+                as.shr(RAX, 4);
+            } else {
+                as.mov32(RAX, displayAt(inst.nestlevel));
+            }
+            as.aluImm(ALU_ADD, RAX, SF_SLOTS + inst.operand, false);
+            storeInt(slot(0), RAX);
+        }
+        //STO and STN, whose address is below the value
+        void store(int at, bool keep) {
+            vector<int> slow;
+            checkInt(slot(1), slow);
+            as.movsxd(RAX, slot(1, 8));
+            resolveAddress(slow);
+            loadValue(slot(0));
+            storeValue(X64Mem(RCX));
+            if (keep) {
+                storeValue(slot(1));
+                as.aluImm(ALU_SUB, R13, 16);
+            } else {
+                as.aluImm(ALU_SUB, R13, 32);
+            }
+            slowPath(slow, at);
+        }
+        void indirectLoad(int at, VMInstruction& inst) {
+            vector<int> slow;
+            checkInt(slot(0), slow);
+            as.movsxd(RAX, slot(0, 8));
+            as.aluImm(ALU_ADD, RAX, inst.operand);
+            resolveAddress(slow);
+            loadValue(X64Mem(RCX));
+            storeValue(slot(0));
+            slowPath(slow, at);
+        }
+        void indexedAccess(int at, VMInstruction& inst) {
+            vector<int> slow;
+            checkInt(slot(1), slow);
+            checkInt(slot(0), slow);
+            as.mov32(RCX, slot(0, 8));
+            as.imul32(RCX, RCX, inst.operand);
+            as.mov32(RAX, slot(1, 8));
+            as.alu(ALU_ADD, RAX, RCX, false);
+            as.aluImm(ALU_SUB, R13, 16);
+            as.mov(slot(0, 8), RAX);
+            slowPath(slow, at);
+        }
+        void markStack(int at) {
+            as.aluImm(ALU_ADD, R13, 64);
+            growCheck();
+            as.lea(RAX, X64Mem(R13, NO_INDEX, -48));
+            as.mov(RCX, R14);
+            as.shr(RCX, 4);
+            for (int i = 0; i < 2; i++) {
+                as.movImm64(X64Mem(R12, RAX, 16*i), AS_INT);
+                as.mov(X64Mem(R12, RAX, 16*i + 8), RCX);
+            }
+            storeInt(X64Mem(R12, RAX, 32), at + 1);
+            as.mov(R14, RAX);
+        }
+        void incTop(VMInstruction& inst) {
+            if (inst.operand <= 0)
+                return;
+            as.aluImm(ALU_ADD, R13, 16*inst.operand);
+            growCheck();
+            for (int i = 0; i < inst.operand; i++)
+                storeInt(slot(i), 0);
+        }
+        //the callee's native code is found through its unit, compiling it
+        //if this is the first call. A callee which can't be compiled, or
+        //recursion deeper than the native stack should go, leaves the
+        //call to the interpreter.
+        void callProcedure(int at, VMInstruction& inst) {
+            int target = inst.operand;
+            if (!isUnitStart(target)) {
+                exitStub({as.jmp()}, at);
+                return;
+            }
+            as.aluImm(ALU_CMP, RBP, JIT_MAX_NATIVE_DEPTH);
+            exitStub({as.jcc(CC_GE)}, at);
+            //a procedure calls itself and one already compiled directly
+            JitUnit& callee = units[owner[target]];
+            bool self = owner[target] == unit;
+            if (!self && callee.entry != nullptr) {
+                as.movImm64(RAX, (int64_t)callee.entry);
+            } else if (!self) {
+                as.movImm64(RAX, (int64_t)&callee.entry);
+                as.mov(RAX, X64Mem(RAX));
+                as.test(RAX, RAX);
+                int compile = as.jcc(CC_E);
+                int resume = as.size();
+                stubs.push_back([=]() {
+                    as.patch(compile, as.size());
+                    callHelper((void*)compileHelper, target);
+                    as.test(RAX, RAX);
+                    exitStub({as.jcc(CC_E)}, at);
+                    as.patch(as.jmp(), resume);
+                });
+            }
+            storeInt(frameSlot(2), at + 1);
+            as.mov32(RDX, displayAt(inst.nestlevel));
+            storeInt(frameSlot(3), RDX);
+            as.mov(RDX, R14);
+            as.shr(RDX, 4);
+            as.mov32(displayAt(inst.nestlevel), RDX);
+            as.aluImm(ALU_ADD, RBP, 1);
+            as.aluImm(ALU_SUB, RSP, 8);
+            if (self)
+                branches.push_back(make_pair(as.call(), target));
+            else
+                as.call(RAX);
+            as.aluImm(ALU_ADD, RSP, 8);
+            as.aluImm(ALU_SUB, RBP, 1);
+            as.test32(RAX, RAX);
+            as.byte(0x74); as.byte(0x01); //jz over the ret
+            as.ret();
+        }
+        //the RET of a block, or of a procedure nested in this one that is
+        //never called, goes back to the interpreter
+        void returnFromProcedure(int at, VMInstruction& inst) {
+            if (inst.nestlevel != units[unit].depth) {
+                exitStub({as.jmp()}, at);
+                return;
+            }
+            as.mov32(RDX, frameSlot(3, 8));
+            as.mov32(displayAt(inst.nestlevel), RDX);
+            loadValue(slot(0));
+            storeValue(frameSlot(0));
+            as.mov(R13, R14);
+            as.movsxd(RAX, frameSlot(2, 8));
+            as.mov(ctx(offsetof(JitContext, ip)), RAX);
+            as.movsxd(R14, frameSlot(1, 8));
+            as.shl(R14, 4);
+            as.movImm32(RAX, JIT_RETURNED);
+            as.ret();
+        }
+        void jumpConditional(VMInstruction& inst) {
+            as.movzx8(RCX, slot(0, 8));
+            as.lea(R13, X64Mem(R13, NO_INDEX, -16));
+            as.movImm64(slot(-1), AS_INT);
+            as.movImm64(slot(-1, 8), 0);
+            as.test32(RCX, RCX);
+            jumpTo(as.jcc(CC_E), inst.operand);
+        }
+        void translate(int at) {
+            VMInstruction& inst = (*code)[at];
+            switch (inst.instruction) {
+                case LAB: case ENT: case MOD:
+                    break;
+                case DEC:
+                    as.aluImm(ALU_SUB, R13, 16*inst.operand);
+                    break;
+                case LDC:
+                    push();
+                    storeInt(slot(0), inst.operand);
+                    break;
+                case LDK:
+                    push();
+                    as.movImm64(RAX, (int64_t)&(*constants)[inst.operand]);
+                    loadValue(X64Mem(RAX));
+                    storeValue(slot(0));
+                    break;
+                case LOD: case LDP: {
+                    if (isHeapAddr(inst.operand)) {
+                        callHelper((void*)step, at);
+                        break;
+                    }
+                    push();
+                    X64Mem m(RAX);
+                    variable(inst, m);
+                    loadValue(m);
+                    storeValue(slot(0));
+                } break;
+                case LDA: loadAddress(inst); break;
+                case LDI: indirectLoad(at, inst); break;
+                case IXA: indexedAccess(at, inst); break;
+                case STO: store(at, false); break;
+                case STN: store(at, true); break;
+                case MST: markStack(at); break;
+                case INC: incTop(inst); break;
+                case CAL: callProcedure(at, inst); break;
+                case TCL:
+                    callHelper((void*)step, at);
+                    jumpTo(as.jmp(), inst.operand);
+                    break;
+                case RET: returnFromProcedure(at, inst); break;
+                case JMP: jumpTo(as.jmp(), inst.operand); break;
+                case JPC: jumpConditional(inst); break;
+                case HALT: exitTo(at + 1, JIT_HALTED); break;
+                case ADD: case SUB: case MUL:
+                case NADD: case NSUB: case NMUL:
+                    arithmetic(at, inst.instruction);
+                    break;
+                case EQU: case NEQ: case LTE: case GTE: case LT: case GT:
+                case NEQU: case NNEQ: case NLTE: case NGTE: case NLT: case NGT:
+                    comparison(at, inst.instruction);
+                    break;
+                case EQUJ: case NEQJ: case LTEJ: case GTEJ: case LTJ: case GTJ:
+                case NEQUJ: case NNEQJ: case NLTEJ: case NGTEJ: case NLTJ: case NGTJ:
+                    compareAndBranch(at, inst.instruction);
+                    break;
+                case INCV: case DECV:
+                    if (isHeapAddr(inst.operand))
+                        callHelper((void*)step, at);
+                    else
+                        updateVariable(at, inst);
+                    break;
+                case LADD: case LSUB:
+                    if (isHeapAddr(inst.operand))
+                        callHelper((void*)step, at);
+                    else
+                        loadAndApplyConstant(at, inst);
+                    break;
+                case ADDC: case SUBC: case MULC:
+                    applyConstant(at, inst);
+                    break;
+                case ADDL: case SUBL: case MULL:
+                    if (isHeapAddr(inst.operand))
+                        callHelper((void*)step, at);
+                    else
+                        applyVariable(at, inst);
+                    break;
+                default:
+                    callHelper((void*)step, at);
+                    break;
+            }
+        }
+        //the rest of a fused sequence, which nothing may branch into
+        bool fusable(int at) {
+            return at < code->size() && owner[at] == unit && !targets[at];
+        }
+        bool isVariableLoad(VMInstruction& inst) {
+            return (inst.instruction == LOD || inst.instruction == LDP) && !isHeapAddr(inst.operand);
+        }
+        bool isCompareAndBranch(int inst) {
+            switch (inst) {
+                case EQUJ: case NEQJ: case LTEJ: case GTEJ: case LTJ: case GTJ:
+                case NEQUJ: case NNEQJ: case NLTEJ: case NGTEJ: case NLTJ: case NGTJ:
+                    return true;
+                default: break;
+            }
+            return false;
+        }
+        //when an operand isn't an int, the slow path of a fused sequence
+        //is each of its instructions translated on its own
+        void unfused(vector<int> from, int at, int count, int pushed = 0) {
+            stubs.push_back([=]() {
+                for (int j : from)
+                    as.patch(j, as.size());
+                if (pushed > 0)
+                    as.aluImm(ALU_SUB, R13, pushed);
+                for (int i = at; i < at + count; i++) {
+                    here = i;
+                    translate(i);
+                }
+                jumpTo(as.jmp(), at + count);
+            });
+        }
+        //LOD x; LDC k; <compare and branch>, which leaves the stack as
+        //it was, compares x with k where it is
+        void compareVariable(int at) {
+            VMInstruction& inst = (*code)[at];
+            VMInstruction& branch = (*code)[at+2];
+            vector<int> slow;
+            growCheck(32);
+            X64Mem m(RAX);
+            variable(inst, m);
+            checkInt(m, slow);
+            as.cmp32(m.offset(8), (*code)[at+1].operand);
+            jumpTo(as.jcc((X64Cond)(conditionOf(branch.instruction) ^ 1)), branch.operand);
+            unfused(slow, at, 3);
+        }
+        //LOD x; ADDC|SUBC k pushes x+k or x-k
+        void loadOffsetVariable(int at) {
+            VMInstruction& inst = (*code)[at];
+            VMInstruction& offset = (*code)[at+1];
+            vector<int> slow;
+            push();
+            X64Mem m(RAX);
+            variable(inst, m);
+            checkInt(m, slow);
+            as.mov32(RAX, m.offset(8));
+            as.aluImm(offset.instruction == ADDC ? ALU_ADD:ALU_SUB, RAX, offset.operand, false);
+            slow.push_back(as.jcc(CC_O));
+            storeInt(slot(0), RAX);
+            unfused(slow, at, 2, 16);
+        }
+        //Translates the sequence at at as one where that saves going
+        //through the stack, returns how many instructions it took or 0.
+        int fuse(int at) {
+            VMInstruction& inst = (*code)[at];
+            if (!isVariableLoad(inst) || !fusable(at+1))
+                return 0;
+            VMInstruction& next = (*code)[at+1];
+            if (next.instruction == LDC && fusable(at+2) && isCompareAndBranch((*code)[at+2].instruction)) {
+                compareVariable(at);
+                return 3;
+            }
+            if (next.instruction == ADDC || next.instruction == SUBC) {
+                loadOffsetVariable(at);
+                return 2;
+            }
+            return 0;
+        }
+        //instructions after which control never falls through
+        bool endsFlow(int inst) {
+            return inst == JMP || inst == RET || inst == HALT || inst == TCL;
+        }
+        bool compile(int u) {
+            as.clear();
+            unit = u;
+            labels.assign(code->size(), -1);
+            branches.clear();
+            stubs.clear();
+            findTargets();
+            findOwnFrame();
+            for (int at = units[u].start; at < code->size(); at++) {
+                if (owner[at] != u)
+                    continue;
+                labels[at] = as.size();
+                here = at;
+                int fused = fuse(at);
+                if (fused > 0)
+                    at += fused - 1;
+                else
+                    translate(at);
+                bool last = at+1 == code->size() || owner[at+1] != u;
+                if (last && !endsFlow((*code)[at].instruction))
+                    return false;
+            }
+            //a stub may add more, which can move the one running
+            for (int i = 0; i < stubs.size(); i++) {
+                function<void()> stub = stubs[i];
+                stub();
+            }
+            for (auto& branch : branches) {
+                if (labels[branch.second] < 0)
+                    return false;
+                as.patch(branch.first, labels[branch.second]);
+            }
+            if (used + as.size() > JIT_ARENA_SIZE)
+                return false;
+            uint8_t* base = arena + used;
+            memcpy(base, as.data(), as.size());
+            used += (as.size() + 15) & ~15;
+            for (int at = 0; at < code->size(); at++)
+                if (owner[at] == u && labels[at] >= 0)
+                    nativeAt[at] = base + labels[at];
+            units[u].entry = nativeAt[units[u].start];
+            return true;
+        }
+        //Called by native code on the first call to a procedure. The
+        //callee of compiled code is compiled too, whether hot or not.
+        static uint8_t* compileHelper(JitContext* ctx, int target) {
+            TemplateJit* jit = (TemplateJit*)ctx->jit;
+            int u = jit->owner[target];
+            if (jit->units[u].entry == nullptr && !jit->units[u].failed)
+                jit->tryCompile(u);
+            return jit->units[u].entry;
+        }
+        //saves what the C calling convention wants kept, keeps the stack
+        //16 byte aligned at the calls native code makes, and enters it
+        //with its registers loaded from the context
+        void emitTrampoline() {
+            as.clear();
+            X64Reg saved[] = { RBX, RBP, R12, R13, R14, R15 };
+            for (X64Reg r : saved)
+                as.push(r);
+            as.aluImm(ALU_SUB, RSP, 8);
+            as.mov(RBX, RDI);
+            as.mov(R12, ctx(offsetof(JitContext, stack)));
+            as.mov(R13, ctx(offsetof(JitContext, sp)));
+            as.mov(R14, ctx(offsetof(JitContext, bp)));
+            as.mov(R15, ctx(offsetof(JitContext, display)));
+            as.mov(R11, ctx(offsetof(JitContext, stackTop)));
+            as.movImm32(RBP, 0);
+            as.call(RSI);
+            as.mov(ctx(offsetof(JitContext, sp)), R13);
+            as.mov(ctx(offsetof(JitContext, bp)), R14);
+            as.aluImm(ALU_ADD, RSP, 8);
+            for (int i = 5; i >= 0; i--)
+                as.pop(saved[i]);
+            as.ret();
+            memcpy(arena, as.data(), as.size());
+            trampoline = (int (*)(JitContext*, uint8_t*))arena;
+            trampolineSize = (as.size() + 15) & ~15;
+        }
+        void tryCompile(int u) {
+            if (compile(u)) {
+                numCompiled++;
+            } else {
+                units[u].failed = true;
+                numFailed++;
+            }
+        }
+    public:
+        TemplateJit(JitStepFn stepHelper, JitStepFn growHelper) {
+            step = stepHelper;
+            grow = growHelper;
+            code = nullptr;
+            constants = nullptr;
+            used = 0;
+            numCompiled = 0;
+            numFailed = 0;
+            trampoline = nullptr;
+            arena = (uint8_t*)mmap(nullptr, JIT_ARENA_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if (arena == MAP_FAILED) {
+                arena = nullptr;
+                return;
+            }
+            emitTrampoline();
+            used = trampolineSize;
+        }
+        ~TemplateJit() {
+            if (arena != nullptr)
+                munmap(arena, JIT_ARENA_SIZE);
+        }
+        //without executable memory everything is interpreted
+        bool available() {
+            return arena != nullptr;
+        }
+        //forgets the code of whatever was loaded before
+        void load(vector<VMInstruction>& codePage, vector<Value>& pool) {
+            code = &codePage;
+            constants = &pool;
+            findUnits();
+            nativeAt.assign(code->size(), nullptr);
+            used = trampolineSize;
+        }
+        //Counts a call or tail call of the procedure entered at ip, or a
+        //loop back edge to ip, and returns the native code to carry on in from there once
+        //its unit is hot and compiled, else nullptr.
+        uint8_t* hot(int at) {
+            int u = owner[at];
+            JitUnit& ju = units[u];
+            if (ju.entry == nullptr) {
+                if (ju.failed || ++ju.count < JIT_HOT_COUNT)
+                    return nullptr;
+                tryCompile(u);
+            }
+            return nativeAt[at];
+        }
+        int run(JitContext* ctx, uint8_t* native) {
+            ctx->jit = this;
+            return trampoline(ctx, native);
+        }
+        void printStats() {
+            cout<<"JIT: "<<numCompiled<<" of "<<units.size()<<" procedures compiled";
+            if (numFailed > 0)
+                cout<<", "<<numFailed<<" left to the interpreter";
+            cout<<"."<<endl;
+        }
+};
+
+#endif
+#endif
\ No newline at end of file
@@ -1,13 +1,22 @@
 #include <iostream>
 #include "compiler.hpp"
 #include "pmachine.hpp"
+#include "regmachine.hpp"
+#include "optimizer.hpp"
 using namespace std;
 
-void repl(bool should_trace) {
+void repl(bool should_trace, int optLevel, int inlineLimit, bool jit, int heapLimit) {
     bool running = true;
     string buff;
     Compiler compiler;
     PCodeVM vm;
+    Optimizer optimizer(optLevel);
+    compiler.setOptLevel(optLevel);
+    compiler.setInlineLimit(inlineLimit);
+    compiler.setTrace(should_trace);
+    vm.setTrace(should_trace);
+    vm.setJit(jit);
+    vm.setHeapLimit((size_t)heapLimit << 20);
     while (running) {
         cout<<"repl> ";
         getline(cin, buff);
@@ -20,49 +29,156 @@ void repl(bool should_trace) {
             compiler.setTrace(false);
             should_trace = false;
         } else {
-            auto pcode = compiler.compile(buff);
+            auto pcode = optimizer.run(compiler.compile(buff));
             if (should_trace) {
                 for (auto p : pcode) {
                     cout<<p<<endl;
                     if (p.instruction == HALT)
                         break;
                 }
+                compiler.printStats();
+                optimizer.printStats();
             }
+            vm.setMemoryExtent(compiler.globalsEnd(), compiler.heapEnd());
             vm.init(pcode);
             vm.execute();
+            if (should_trace) {
+                cout<<"Stack high-water mark: "<<vm.stackHighWater()<<" slots."<<endl;
+                vm.printRegExStats();
+            }
         }
     }
 }
 
-void compileAndRunFromFile(string filename, bool trace) {
-    Compiler compiler;
+//the listing and the statistics are only printed with -stats or -v,
+//so that what a file prints is the program's own output
+void runPCode(Compiler& compiler, Optimizer& optimizer, vector<Instruction>& code, bool trace, bool stats, bool jit, bool profile, int heapLimit) {
     PCodeVM vm;
-    compiler.setTrace(trace);
     vm.setTrace(trace);
-    auto pcode = compiler.compileFile(filename);
-    int i = 0;
-    for (auto p : pcode) {
-        cout<<i++<<": "<<p<<endl;
-        if (p.instruction == HALT)
-            break;
+    vm.setJit(jit);
+    vm.setProfile(profile);
+    vm.setHeapLimit((size_t)heapLimit << 20);
+    optimizer.setKeepEntries(profile);
+    auto pcode = optimizer.run(code);
+    if (stats) {
+        int i = 0;
+        for (auto p : pcode) {
+            cout<<i++<<": "<<p<<endl;
+            if (p.instruction == HALT)
+                break;
+        }
+        compiler.printStats();
+        optimizer.printStats();
     }
+    vm.setMemoryExtent(compiler.globalsEnd(), compiler.heapEnd());
     vm.init(pcode);
     vm.execute();
+    if (stats) {
+        cout<<"Stack high-water mark: "<<vm.stackHighWater()<<" slots."<<endl;
+        vm.printJitStats();
+        vm.printGCStats();
+    }
+    vm.printProfile();
+    if (trace)
+        vm.printRegExStats();
 }
 
+void compileAndRunFromFile(string filename, bool trace, bool stats, int optLevel, int inlineLimit, bool jit, bool profile, int heapLimit) {
+    Compiler compiler;
+    Optimizer optimizer(optLevel);
+    compiler.setOptLevel(optLevel);
+    compiler.setInlineLimit(inlineLimit);
+    compiler.setTrace(trace);
+    runPCode(compiler, optimizer, compiler.compileFile(filename), trace, stats, jit, profile, heapLimit);
+}
 
-int main(int argc, char* argv[]) {
-    if (argc < 2)
-        repl(false);
-    switch (argc) {
-        case 2:
-            compileAndRunFromFile(argv[1], false);
-            break;
-        case 3:
-            compileAndRunFromFile(argv[2], true);
-        default:
-            break;
+//programs using what only the P-machine has are run there instead
+void compileAndRunOnRegisters(string filename, bool trace, bool stats, int optLevel, int inlineLimit, bool jit, bool profile, int heapLimit) {
+    Compiler compiler;
+    Optimizer optimizer(optLevel);
+    RegProgram program;
+    compiler.setOptLevel(optLevel);
+    compiler.setInlineLimit(inlineLimit);
+    compiler.setTrace(trace);
+    string unsupported = compiler.compileFileToRegisters(filename, program);
+    if (!unsupported.empty()) {
+        cout<<"Register machine: "<<unsupported<<" not supported, using the P-machine."<<endl;
+        runPCode(compiler, optimizer, compiler.compileParsed(), trace, stats, jit, profile, heapLimit);
+        return;
+    }
+    if (stats) {
+        int i = 0;
+        for (auto& inst : program.code)
+            cout<<i++<<": "<<inst<<endl;
+        compiler.printStats();
+    }
+    RegisterVM vm(trace);
+    vm.setHeapLimit((size_t)heapLimit << 20);
+    vm.init(program);
+    vm.execute();
+    if (stats) {
+        cout<<"Register high-water mark: "<<vm.registerHighWater()<<" registers."<<endl;
+        vm.printGCStats();
+    }
+}
 
+void usage() {
+    cout<<"usage: dalgol [-v] [-stats] [-O0|-O1|-O2] [-inline=N] [-backend=pcode|register] [--no-jit] [-profile] [-heap=N] [file]"<<endl;
+    cout<<"  -v    trace compilation and execution, dalgol x file does the same"<<endl;
+    cout<<"  -stats  list the code a file compiles to, and report what the optimizer, the JIT and the GC did"<<endl;
+    cout<<"  -On   optimization level, default -O"<<DEFAULT_OPT_LEVEL<<endl;
+    cout<<"  -inline=N  at -O2, inline procedures of up to N AST nodes, default "<<DEFAULT_INLINE_LIMIT<<", 0 disables"<<endl;
+    cout<<"  -backend=B  run a file on the stack based P-machine (pcode, the default) or the register machine"<<endl;
+    cout<<"  --no-jit  interpret everything on the P-machine, rather than compiling hot procedures to native code"<<endl;
+    cout<<"  -profile  count the instructions a file runs on the P-machine and the time spent in each, then report"<<endl;
+    cout<<"            the hottest instructions and procedures and the opcode mix, native code is not used"<<endl;
+    cout<<"  -heap=N  collect garbage to keep the strings a program makes under N megabytes, default "<<(DEFAULT_HEAP_LIMIT >> 20)<<endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool trace = false;
+    bool stats = false;
+    int optLevel = DEFAULT_OPT_LEVEL;
+    int inlineLimit = DEFAULT_INLINE_LIMIT;
+    bool registers = false;
+    bool jit = true;
+    bool profile = false;
+    int heapLimit = DEFAULT_HEAP_LIMIT >> 20;
+    string filename;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-v") {
+            trace = true;
+        } else if (arg == "-stats") {
+            stats = true;
+        } else if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '2') {
+            optLevel = arg[2] - '0';
+        } else if (arg.rfind("-inline=", 0) == 0 && arg.size() > 8 && isdigit(arg[8])) {
+            inlineLimit = stoi(arg.substr(8));
+        } else if (arg == "-backend=pcode" || arg == "-backend=register") {
+            registers = arg == "-backend=register";
+        } else if (arg == "--no-jit") {
+            jit = false;
+        } else if (arg == "-profile") {
+            profile = true;
+        } else if (arg.rfind("-heap=", 0) == 0 && arg.size() > 6 && isdigit(arg[6])) {
+            heapLimit = stoi(arg.substr(6));
+        } else if (arg[0] == '-') {
+            usage();
+            return 1;
+        } else if (!filename.empty()) {
+            //the original form, dalgol x file
+            trace = true;
+            filename = arg;
+        } else {
+            filename = arg;
+        }
     }
+    if (filename.empty())
+        repl(trace, optLevel, inlineLimit, jit, heapLimit);
+    else if (registers)
+        compileAndRunOnRegisters(filename, trace, trace || stats, optLevel, inlineLimit, jit, profile, heapLimit);
+    else
+        compileAndRunFromFile(filename, trace, trace || stats, optLevel, inlineLimit, jit, profile, heapLimit);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef memory_layout_hpp
+#define memory_layout_hpp
+
+//Addresses handed out by the symbol table and used by the VM are
+//plain ints. The range an address falls in selects its region:
+//
+//  [0, GLOBAL_BASE)          the stack: absolute slots, or frame
+//                            relative offsets in LOD/LDA/STP operands
+//  [GLOBAL_BASE, HEAP_BASE)  global variables and arrays
+//  [HEAP_BASE, ...)          records allocated with new
+//
+//Each region is stored separately by the VM and grows on demand, all
+//three are allocated and indexed upwards from their base.
+const int GLOBAL_BASE = 1 << 28;
+const int HEAP_BASE = 1 << 29;
+
+//A stack frame starts with its dynamic link, static link, return
+//address and the display entry it replaced, then the parameters
+//and locals the frame relative offsets count from.
+const int SF_SLOTS = 4;
+
+bool isStackAddr(int addr) {
+    return addr < GLOBAL_BASE;
+}
+
+bool isGlobalAddr(int addr) {
+    return addr >= GLOBAL_BASE && addr < HEAP_BASE;
+}
+
+bool isHeapAddr(int addr) {
+    return addr >= HEAP_BASE;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef optimizer_hpp
+#define optimizer_hpp
+#include <iostream>
+#include <vector>
+#include "vminst.hpp"
+#include "peephole.hpp"
+#include "superinstructions.hpp"
+using namespace std;
+
+//Runs the passes over generated code that the optimization level asks for:
+//  -O0  none, the code is loaded as generated
+//  -O1  peephole
+//  -O2  peephole, then superinstructions
+const int DEFAULT_OPT_LEVEL = 2;
+
+class Optimizer {
+    private:
+        int level;
+        PeepholeOptimizer peephole;
+        SuperInstructionPass fuser;
+    public:
+        Optimizer(int optLevel = DEFAULT_OPT_LEVEL) {
+            level = optLevel;
+        }
+        void setLevel(int optLevel) {
+            level = optLevel;
+        }
+        int getLevel() {
+            return level;
+        }
+        //the profiler names procedures after their ENT
+        void setKeepEntries(bool keep) {
+            peephole.setKeepEntries(keep);
+        }
+        vector<Instruction> run(vector<Instruction>& code) {
+            if (level < 1)
+                return code;
+            vector<Instruction> result = peephole.run(code);
+            if (level >= 2)
+                result = fuser.run(result);
+            return result;
+        }
+        void printStats() {
+            if (level >= 1)
+                peephole.printStats();
+            if (level >= 2)
+                fuser.printStats();
+        }
+};
+
+#endif
\ No newline at end of file
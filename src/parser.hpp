@@ -26,6 +26,7 @@ bool isRelOp(Symbol sym) {
 class Parser {
     private:
         TokenStream ts;
+        Arena nodes; //the tree of the last parse
         Token lookahead() {
             return ts.get();
         }
@@ -47,7 +48,9 @@ class Parser {
         Parser() {
 
         }
+        //frees the tree the last call returned
         ASTNode* parse(TokenStream tokenStream) {
+            nodes.reset();
             ts = tokenStream;
             ASTNode* node = program();
             return node;
@@ -56,7 +59,7 @@ class Parser {
         ASTNode* program() {
             ASTNode* program;
             if (expect(TK_PROGRAM)) {
-                program = makeStmtNode(PROGRAM_STMT, lookahead());
+                program = makeStmtNode(nodes, PROGRAM_STMT, lookahead());
                 match(TK_PROGRAM);
                 match(TK_ID);
                 match(TK_BEGIN);
@@ -94,7 +97,7 @@ class Parser {
                     node = defineStruct();
                 } break;
                 case TK_PRINT: {
-                    node = makeStmtNode(PRINT_STMT, lookahead());
+                    node = makeStmtNode(nodes, PRINT_STMT, lookahead());
                     match(TK_PRINT);
                     node->child[0] = simpleExpr();
                 } break;
@@ -105,7 +108,7 @@ class Parser {
                     node = ifStatement();
                 } break;
                 case TK_RETURN: {
-                    node = makeStmtNode(RETURN_STMT, lookahead());
+                    node = makeStmtNode(nodes, RETURN_STMT, lookahead());
                     match(TK_RETURN);
                     node->child[0] = simpleExpr();
                 } break;
@@ -116,7 +119,7 @@ class Parser {
                 case TK_ID: 
                 case TK_LP:
                 case TK_NUM: {
-                    node = makeStmtNode(EXPR_STMT, lookahead());
+                    node = makeStmtNode(nodes, EXPR_STMT, lookahead());
                     ASTNode* t = simpleExpr();
                     node->child[0] = t;
                 } break;
@@ -125,7 +128,7 @@ class Parser {
             return node;
         }
         ASTNode* whileStatement() {
-            ASTNode* node = makeStmtNode(WHILE_STMT, lookahead());
+            ASTNode* node = makeStmtNode(nodes, WHILE_STMT, lookahead());
             match(TK_WHILE);
             match(TK_LP);
             node->child[0] = simpleExpr();
@@ -135,7 +138,7 @@ class Parser {
             return node;
         }
         ASTNode* ifStatement() {
-            ASTNode* node = makeStmtNode(IF_STMT, lookahead());
+            ASTNode* node = makeStmtNode(nodes, IF_STMT, lookahead());
             match(TK_IF);
             match(TK_LP);
             node->child[0] = simpleExpr();
@@ -149,7 +152,7 @@ class Parser {
             return node;
         }
         ASTNode* defineStruct() {
-            ASTNode* node = makeStmtNode(STRUCT_STMT, lookahead());
+            ASTNode* node = makeStmtNode(nodes, STRUCT_STMT, lookahead());
             match(TK_STRUCT);
             node->data.strval = lookahead().strval;
             match(TK_ID);
@@ -159,7 +162,7 @@ class Parser {
         ASTNode* functionDefinition() {
             ASTNode* node = nullptr;
             if (expect(TK_FUNC)) {
-                node = makeStmtNode(FUNC_DEF_STMT, lookahead());
+                node = makeStmtNode(nodes, FUNC_DEF_STMT, lookahead());
                 match(TK_FUNC);
                 if (expect(TK_ID)) {
                     node->data = lookahead();
@@ -186,13 +189,13 @@ class Parser {
             return node;
         }
         ASTNode* letStatement() {
-            ASTNode* node = makeStmtNode(LET_STMT, lookahead());
+            ASTNode* node = makeStmtNode(nodes, LET_STMT, lookahead());
             match(TK_LET);
             node->data = lookahead();
             match(TK_ID);
             if (expect(TK_LB)) {
                 match(TK_LB);
-                node->child[0] = makeExprNode(SUBSCRIPT_EXPR, lookahead());
+                node->child[0] = makeExprNode(nodes, SUBSCRIPT_EXPR, lookahead());
                 node->child[0]->child[0] = simpleExpr();
                 match(TK_RB);
             } else if (expect(TK_ASSIGN)) {
@@ -204,7 +207,7 @@ class Parser {
         ASTNode* simpleExpr() {
             ASTNode* node = relExpr();
             if (expect(TK_ASSIGN)) {
-                ASTNode* t = makeExprNode(ASSIGN_EXPR, lookahead());
+                ASTNode* t = makeExprNode(nodes, ASSIGN_EXPR, lookahead());
                 match(TK_ASSIGN);
                 t->child[0] = node;
                 node = t;
@@ -215,7 +218,7 @@ class Parser {
         ASTNode* relExpr() {
             ASTNode* node = expression();
             while (isRelOp(lookahead().symbol)) {
-                ASTNode* t = makeExprNode(RELOP_EXPR, lookahead());
+                ASTNode* t = makeExprNode(nodes, RELOP_EXPR, lookahead());
                 match(lookahead().symbol);
                 t->child[0] = node;
                 t->child[1] = expression();
@@ -226,7 +229,7 @@ class Parser {
         ASTNode* expression() {
             ASTNode* node = term();
             while (expect(TK_ADD) || expect(TK_SUB)) {
-                ASTNode* t = makeExprNode(BINOP_EXPR, lookahead());
+                ASTNode* t = makeExprNode(nodes, BINOP_EXPR, lookahead());
                 match(lookahead().symbol);
                 t->child[0] = node;
                 t->child[1] = term();
@@ -237,7 +240,7 @@ class Parser {
         ASTNode* term() {
             ASTNode* node = factor();
             while (expect(TK_MUL) || expect(TK_DIV)) {
-                ASTNode* t = makeExprNode(BINOP_EXPR, lookahead());
+                ASTNode* t = makeExprNode(nodes, BINOP_EXPR, lookahead());
                 match(lookahead().symbol);
                 t->child[0] = node;
                 t->child[1] = factor();
@@ -248,13 +251,13 @@ class Parser {
         ASTNode* factor() {
             ASTNode* node;
             if (expect(TK_SUB)) {
-                node = makeExprNode(UNOP_EXPR, lookahead());
+                node = makeExprNode(nodes, UNOP_EXPR, lookahead());
                 match(TK_SUB);
                 node->child[0] = factor();
                 return node;
             }
             if (expect(TK_NOT)) {
-                node = makeExprNode(UNOP_EXPR, lookahead());
+                node = makeExprNode(nodes, UNOP_EXPR, lookahead());
                 match(TK_NOT);
                 node->child[0] = factor();
                 return node;
@@ -266,7 +269,7 @@ class Parser {
             ASTNode* node = val();
             if (expect(TK_LB)) {
                 while (expect(TK_LB)) {
-                    ASTNode* t = makeExprNode(SUBSCRIPT_EXPR, lookahead());
+                    ASTNode* t = makeExprNode(nodes, SUBSCRIPT_EXPR, lookahead());
                     match(TK_LB);
                     t->child[0] = simpleExpr();
                     match(TK_RB);
@@ -274,20 +277,20 @@ class Parser {
                 }
             } else if (expect(TK_PERIOD)) {
                 while (expect(TK_PERIOD)) {
-                    ASTNode* t = makeExprNode(FIELD_EXPR, lookahead());
+                    ASTNode* t = makeExprNode(nodes, FIELD_EXPR, lookahead());
                     match(TK_PERIOD);
-                    t->child[0] = makeExprNode(ID_EXPR, lookahead());
+                    t->child[0] = makeExprNode(nodes, ID_EXPR, lookahead());
                     match(TK_ID);
                     node->child[0] = t;
                 }
             } else if (expect(TK_POST_INC) || expect(TK_POST_DEC)) {
-                ASTNode* t = makeExprNode(UNOP_EXPR, lookahead());
+                ASTNode* t = makeExprNode(nodes, UNOP_EXPR, lookahead());
                 match(lookahead().symbol);
                 t->child[0] = node;
                 node = t;
             }
             if (expect(TK_LP)) {
-                ASTNode* t = makeExprNode(FUNC_EXPR, lookahead());
+                ASTNode* t = makeExprNode(nodes, FUNC_EXPR, lookahead());
                 match(TK_LP);
                 t->data = node->data;
                 node = t;
@@ -300,17 +303,18 @@ class Parser {
         ASTNode* val() {
             ASTNode* node = nullptr;
             if (expect(TK_NUM)) {
-                node = makeExprNode(CONST_EXPR, lookahead());
+                node = makeExprNode(nodes, CONST_EXPR, lookahead());
+                node->value = makeReal(stod(lookahead().strval));
                 match(TK_NUM);
                 return node;
             }
             if (expect(TK_ID)) {
-                node = makeExprNode(ID_EXPR, lookahead());
+                node = makeExprNode(nodes, ID_EXPR, lookahead());
                 match(TK_ID);
                 return node;
             }
             if (expect(TK_STR)) {
-                node = makeExprNode(STR_EXPR, lookahead());
+                node = makeExprNode(nodes, STR_EXPR, lookahead());
                 match(TK_STR);
                 return node;
             }
@@ -321,13 +325,13 @@ class Parser {
                 return node;
             }
             if (expect(TK_NEW)) {
-                node = makeExprNode(BLESS_EXPR, lookahead());
+                node = makeExprNode(nodes, BLESS_EXPR, lookahead());
                 match(TK_NEW);
                 node->child[0] = simpleExpr();
                 return node;
             }
             if (expect(TK_MATCH)) {
-                node = makeExprNode(REG_EXPR, lookahead());
+                node = makeExprNode(nodes, REG_EXPR, lookahead());
                 match(TK_MATCH);
                 match(TK_LP);
                 node->child[0] = simpleExpr();
@@ -350,7 +354,7 @@ class Parser {
         }
         ASTNode* paramList() {
             match(TK_LET);
-            ASTNode* m = makeStmtNode(LET_STMT, lookahead());
+            ASTNode* m = makeStmtNode(nodes, LET_STMT, lookahead());
             ASTNode* c = m;
             if (expect(TK_REF)) {
                 match(TK_REF);
@@ -361,7 +365,7 @@ class Parser {
             while (!expect(TK_RP)) {
                 match(TK_COMA);
                 match(TK_LET);
-                c->next = makeStmtNode(LET_STMT, lookahead());
+                c->next = makeStmtNode(nodes, LET_STMT, lookahead());
                 c = c->next;
                 if (expect(TK_REF)) {
                     match(TK_REF);
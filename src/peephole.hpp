@@ -0,0 +1,194 @@
+#ifndef peephole_hpp
+#define peephole_hpp
+#include <iostream>
+#include <vector>
+#include "vminst.hpp"
+using namespace std;
+
+//Cleans up the code PCodeGenerator emits before it is loaded:
+//
+//  LAB, ENT                        ->  removed, they do nothing at runtime,
+//                                      ENT is kept for the profiler's names
+//  JMP L; L:                       ->  removed
+//  JMP|JPC L; L: JMP M             ->  JMP|JPC M
+//  JMP|TCL|HALT|RET; <no target>   ->  removed up to the next branch target
+//  STN; <anything but RET>         ->  STO outside procedures, where the
+//                                      stored value is never used
+//
+//The passes only mark instructions dead and record new branch targets,
+//the generator's code is left alone. It is copied out compacted once
+//at the end, with every branch relocated.
+class PeepholeOptimizer {
+    private:
+        int noops;
+        int jumpsToNext;
+        int unreachable;
+        int threaded;
+        int stores;
+        bool keepEntries;
+        vector<bool> live;
+        vector<int> nextLive; //first live instruction at or after i
+        vector<int> dest;     //branch target of instruction i
+        vector<bool> destructive;
+        bool inRange(int addr) {
+            return addr >= 0 && addr <= live.size();
+        }
+        void findNextLive() {
+            nextLive = vector<int>(live.size()+1, live.size());
+            for (int i = live.size()-1; i >= 0; i--)
+                nextLive[i] = live[i] ? i:nextLive[i+1];
+        }
+        void removeNoOps(vector<Instruction>& code) {
+            for (int i = 0; i < code.size(); i++) {
+                if (code[i].instruction == LAB || (code[i].instruction == ENT && !keepEntries)) {
+                    live[i] = false;
+                    noops++;
+                }
+            }
+        }
+        //Scanning backwards means everything after i is already final
+        //when the jump at i is looked at.
+        void removeJumpsToNext(vector<Instruction>& code) {
+            nextLive[code.size()] = code.size();
+            for (int i = code.size()-1; i >= 0; i--) {
+                int target = dest[i];
+                if (live[i] && code[i].instruction == JMP && target > i && inRange(target) && nextLive[target] == nextLive[i+1]) {
+                    live[i] = false;
+                    jumpsToNext++;
+                }
+                nextLive[i] = live[i] ? i:nextLive[i+1];
+            }
+        }
+        void threadJumps(vector<Instruction>& code) {
+            for (int i = 0; i < code.size(); i++) {
+                Inst op = code[i].instruction;
+                if (!live[i] || (op != JMP && op != JPC) || !inRange(dest[i]))
+                    continue;
+                int target = nextLive[dest[i]];
+                int to = target;
+                //the step limit stops on a loop made only of jumps
+                for (int steps = 0; steps < code.size() && to < code.size() && code[to].instruction == JMP; steps++) {
+                    if (!inRange(dest[to]))
+                        break;
+                    to = nextLive[dest[to]];
+                }
+                if (to != target)
+                    threaded++;
+                dest[i] = to;
+            }
+        }
+        //procedure entries are always kept: the repl may
+        //call a procedure defined by an earlier line.
+        void removeUnreachable(vector<Instruction>& code) {
+            vector<bool> targets(code.size()+1, false);
+            for (int i = 0; i < code.size(); i++) {
+                if (live[i] && isBranchInst(code[i].instruction) && inRange(dest[i]))
+                    targets[nextLive[dest[i]]] = true;
+                if (code[i].instruction == ENT)
+                    targets[nextLive[i]] = true;
+            }
+            bool reachable = true;
+            for (int i = 0; i < code.size(); i++) {
+                if (!live[i])
+                    continue;
+                if (targets[i])
+                    reachable = true;
+                if (!reachable) {
+                    live[i] = false;
+                    unreachable++;
+                    continue;
+                }
+                switch (code[i].instruction) {
+                    case JMP: case TCL: case HALT: case RET:
+                        reachable = false;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        //A let leaves its value on the stack with STN. In a procedure that
+        //value is its result when nothing is pushed after it before the RET,
+        //which needn't be the next instruction, so only stores made by the
+        //main program (and the blocks in it) are made destructive. A named
+        //ENT starts a procedure and a plain one a block, each ends at its RET.
+        void dropDeadStores(vector<Instruction>& code) {
+            vector<bool> scopes; //true for a procedure
+            int procedures = 0;
+            int prev = -1;
+            for (int i = 0; i < code.size(); i++) {
+                if (code[i].instruction == ENT) {
+                    scopes.push_back(typeOf(code[i].operand) == AS_STRING);
+                    procedures += scopes.back();
+                } else if (code[i].instruction == RET && !scopes.empty()) {
+                    procedures -= scopes.back();
+                    scopes.pop_back();
+                }
+                if (!live[i])
+                    continue;
+                if (prev >= 0 && code[prev].instruction == STN && code[i].instruction != RET && procedures == 0) {
+                    destructive[prev] = true;
+                    stores++;
+                }
+                prev = i;
+            }
+        }
+        vector<Instruction> compact(vector<Instruction>& code) {
+            vector<Instruction> result;
+            vector<int> relocated(code.size()+1);
+            int count = 0;
+            for (int i = 0; i < code.size(); i++) {
+                relocated[i] = count;
+                if (live[i]) count++;
+            }
+            relocated[code.size()] = count;
+            result.reserve(count);
+            for (int i = 0; i < code.size(); i++) {
+                if (!live[i])
+                    continue;
+                result.push_back(code[i]);
+                Instruction& inst = result.back();
+                if (isBranchInst(inst.instruction) && inRange(dest[i]))
+                    inst.operand = makeInt(relocated[dest[i]]);
+                if (destructive[i])
+                    inst.instruction = STO;
+            }
+            return result;
+        }
+    public:
+        PeepholeOptimizer() {
+            noops = 0;
+            jumpsToNext = 0;
+            unreachable = 0;
+            threaded = 0;
+            stores = 0;
+            keepEntries = false;
+        }
+        void setKeepEntries(bool keep) {
+            keepEntries = keep;
+        }
+        vector<Instruction> run(vector<Instruction>& code) {
+            noops = jumpsToNext = unreachable = threaded = stores = 0;
+            live = vector<bool>(code.size(), true);
+            destructive = vector<bool>(code.size(), false);
+            dest = vector<int>(code.size());
+            for (int i = 0; i < code.size(); i++)
+                dest[i] = isBranchInst(code[i].instruction) ? getInteger(code[i].operand):-1;
+            removeNoOps(code);
+            findNextLive();
+            removeJumpsToNext(code);
+            threadJumps(code);
+            removeUnreachable(code);
+            dropDeadStores(code);
+            return compact(code);
+        }
+        int removedCount() {
+            return noops + jumpsToNext + unreachable;
+        }
+        void printStats() {
+            cout<<"Peephole: "<<removedCount()<<" instructions removed ("<<noops<<" no-ops, "<<jumpsToNext<<" jumps to next, ";
+            cout<<unreachable<<" unreachable), "<<threaded<<" jumps threaded, "<<stores<<" stores made destructive."<<endl;
+        }
+};
+
+#endif
\ No newline at end of file
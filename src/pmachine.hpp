@@ -6,10 +6,20 @@
 #include "regex/re_compiler.hpp"
 #include "regex/patternmatcher.hpp"
 #include "regex/nfa.hpp"
+#include "regex/re_cache.hpp"
 #include "value.hpp"
 #include "vminst.hpp"
+#include "memory_layout.hpp"
+#include "jit.hpp"
+#include "profiler.hpp"
 using namespace std;
 
+// Labels-as-values lets the interpreter jump straight from one
+// handler to the next. Compilers without it get the switch loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(DALGOL_NO_COMPUTED_GOTO)
+#define DALGOL_COMPUTED_GOTO
+#endif
+
 struct StackFrame {
     int returnAddr;
     int staticLink;
@@ -22,18 +32,25 @@ struct StackFrame {
         baseptr = bp;
     }
 };
-const int SF_SLOTS = 4;
+const int MAX_DEPTH = 256;
 
 class PCodeVM {
     private:
         bool should_trace;
-        const int MAX_STACK = 7000;
-        const int HEAP_SIZE = 2000;
-        const int MIN_GLOBAL_ADDR = MAX_STACK - HEAP_SIZE;
-        const int MAX_GLOBAL_ADDR = 3000;
-        vector<Instruction> codePage;
+        const int INITIAL_STACK = 1024;
+        vector<VMInstruction> codePage;
+        vector<Value> constants;
         vector<Value> stack;
-        Instruction curr;
+        vector<Value> globals;
+        vector<Value> heap;
+        vector<CompiledRegEx> patterns; //literal patterns, indexed by MATCHRE's operand
+        RegExCache regexCache;
+        Value badAddress;
+        int globalsEnd; //one past the last address the symbol table gave out
+        int heapEnd;
+        int stackTop; //high-water mark of sp
+        int display[MAX_DEPTH]; //base ptr of the active frame at each lexical depth
+        VMInstruction* curr;
         int sp; //stack pointer
         int ip; //instruction pointer
         int bp; //base pointer
@@ -41,43 +58,119 @@ class PCodeVM {
         int sl; //dynamic link
         int dl; //static link
         int ra; //return addr
-        Instruction current() {
-            return curr;
+#ifdef DALGOL_JIT
+        TemplateJit jit;
+        JitContext jitContext;
+#endif
+        bool useJit;
+        Profiler profiler;
+        bool useProfile;
+        VMInstruction& current() {
+            return *curr;
         }
-        int base(int lvl) {
-            int np = bp;
-            while (lvl > 0) {
-                np = getValue(stack[np+1]);
-                lvl--;
+        //every push moves sp past the highest slot used so far before it
+        //can move past the end of the stack, so that one comparison is
+        //both the bounds check and the high-water mark.
+        void checkStack() {
+            if (sp > stackTop)
+                growStack();
+        }
+        void growStack() {
+            if (sp >= GLOBAL_BASE) {
+                cout<<"Error: stack overflow"<<endl;
+                exit(EXIT_FAILURE);
             }
-            return np+SF_SLOTS;
+            stackTop = sp;
+            if (stackTop >= stack.size())
+                stack.resize(max(2*(int)stack.size(), stackTop+1));
+        }
+        //for addresses computed at run time: arrays, records and
+        //anything stored through STO/STN/STP. The globals and the heap
+        //are only as big as the symbol table made them, past that an
+        //index is out of bounds.
+        Value& memoryAt(int addr) {
+            if (addr >= 0 && addr <= stackTop)
+                return stack[addr];
+            if (isGlobalAddr(addr) && addr - GLOBAL_BASE < globals.size())
+                return globals[addr - GLOBAL_BASE];
+            if (isHeapAddr(addr) && addr - HEAP_BASE < heap.size())
+                return heap[addr - HEAP_BASE];
+            cout<<"Error: invalid address: "<<addr<<endl;
+            badAddress = makeNil();
+            return badAddress;
+        }
+        //for addresses taken from an instruction operand, these were
+        //already bounds checked by reserveMemory() when the code was loaded.
+        Value& operandAt(int addr) {
+            if (isStackAddr(addr))
+                return stack[addr];
+            if (isGlobalAddr(addr))
+                return globals[addr - GLOBAL_BASE];
+            return heap[addr - HEAP_BASE];
+        }
+        void compilePatterns() {
+            int count = 0;
+            for (VMInstruction& inst : codePage)
+                if (inst.instruction == MATCHRE && inst.operand >= 0)
+                    count++;
+            patterns.clear();
+            patterns.reserve(count);
+            for (VMInstruction& inst : codePage) {
+                if (inst.instruction == MATCHRE && inst.operand >= 0) {
+                    patterns.push_back(compileRegEx(toStdString(constants[inst.operand])));
+                    inst.operand = patterns.size()-1;
+                }
+            }
+        }
+        void reserveMemory() {
+            globals.resize(max((int)globals.size(), globalsEnd - GLOBAL_BASE));
+            heap.resize(max((int)heap.size(), heapEnd - HEAP_BASE));
+            for (VMInstruction& inst : codePage) {
+                switch (inst.instruction) {
+                    case LOD: case LDP:
+                    case INCV: case DECV: case LADD: case LSUB:
+                    case ADDL: case SUBL: case MULL:
+                        if (!isStackAddr(inst.operand))
+                            memoryAt(inst.operand);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        int base(int lvl) {
+            return display[lvl]+SF_SLOTS;
         }
         int getValue(Value val) {
-            return  val.type == AS_INT ? getInteger(val):getReal(val);
+            return  typeOf(val) == AS_INT ? getInteger(val):getReal(val);
         }
+        template <bool tracing>
         int calculateAddress(int offset) {
             int bn = 0;
-            if (offset < MAX_GLOBAL_ADDR)
-                bn = base(getInteger(current().nestlevel));
-            if (should_trace) {
+            if (isStackAddr(offset))
+                bn = base(current().nestlevel);
+            if (tracing) {
                 cout<<"Relative Addr: "<<offset<<endl;
                 cout<<"BP: "<<bn<<endl;
                 cout<<"Calculated ad: "<<bn+SF_SLOTS+offset<<endl;
             }
             return bn+offset;
         }
+        template <bool tracing, bool profiling>
         void nextInstruction() {
-            curr = codePage[ip++];
-            if (should_trace)
-                cout<<"Executing: "<<ip-1<<": "<<instStr[current().instruction]<<" "<<*toString(current().operand)<<" "<<*toString(current().nestlevel)<<endl;
+            if (profiling)
+                profiler.enter(ip);
+            curr = &codePage[ip++];
+            if (tracing)
+                cout<<"Executing: "<<ip-1<<": "<<instStr[current().instruction]<<" "<<operandStr(current())<<" "<<(int)current().nestlevel<<endl;
         }
         void doJump() {
-            int next = getInteger(current().operand);
+            int next = current().operand;
             ip = next;
         }
         void jumpConditional() {
             if (getBoolean(stack[sp]) == false) {
-                int next = getInteger(current().operand);
+                int next = current().operand;
                 ip = next;
             }
             sp--;
@@ -85,113 +178,166 @@ class PCodeVM {
         }
         void loadConstant() {
             sp += 1;
-            stack[sp] = current().operand;
+            checkStack();
+            stack[sp] = makeInt(current().operand);
         }
+        void loadPooledConstant() {
+            sp += 1;
+            checkStack();
+            stack[sp] = constants[current().operand];
+        }
+        string operandStr(VMInstruction& inst) {
+            switch (inst.instruction) {
+                case LDK:
+                case LAB:
+                case ENT: return toStdString(constants[inst.operand]);
+                default: break;
+            }
+            return to_string(inst.operand);
+        }
+        template <bool tracing>
         void loadFromAddress() {
             sp += 1;
-            int addr = calculateAddress(getInteger(current().operand));
-            stack[sp] = stack[addr];
+            checkStack();
+            int addr = calculateAddress<tracing>(current().operand);
+            stack[sp] = operandAt(addr);
         }
+        template <bool tracing>
         void loadAddress() {
             sp += 1;
-            int addr = calculateAddress(getInteger(current().operand));
+            checkStack();
+            int addr = calculateAddress<tracing>(current().operand);
             stack[sp] = makeInt(addr);
         }
         void loadReferenceParam() {
             sp += 1;
-            int os = getValue(current().operand);
-            int addr = os < 2000 ? getValue(stack[bp+1])+SF_SLOTS + os:os;
+            checkStack();
+            int os = current().operand;
+            int addr = isStackAddr(os) ? base(current().nestlevel) + os:os;
             stack[sp] = makeInt(addr);
         }
         void loadParam() {
             sp += 1;
-            int os = getValue(current().operand);
-            int addr = os < 2000 ? getValue(stack[bp+1])+SF_SLOTS + os:os;
-            stack[sp] = stack[addr];
+            checkStack();
+            int os = current().operand;
+            int addr = isStackAddr(os) ? base(current().nestlevel) + os:os;
+            stack[sp] = operandAt(addr);
         }
         void loadField() {
             sp += 1;
-            int os = getValue(current().operand);
-            int addr = os < 2000 ? getValue(stack[bp+1])+1 + os:os;
+            checkStack();
+            int os = current().operand;
+            int addr = isStackAddr(os) ? getValue(stack[bp+1])+1 + os:os;
             stack[sp] = makeInt(addr);
         }
+        template <bool tracing>
         void indirectLoad() {
-            int indAddr = 0;
             int base = getValue(stack[sp]);
-            int offset = getInteger(current().operand);
-            if (base > MAX_GLOBAL_ADDR) {
-                indAddr = base - offset;
-            } else {
-                indAddr = base + offset;
-            }
-            if (should_trace) {
+            int offset = current().operand;
+            int indAddr = base + offset;
+            if (tracing) {
                 cout<<"Base Addr:  "<<base<<", Offset:     "<<offset<<endl;
                 cout<<"Indirected: "<<indAddr<<endl;
             }    
-            stack[sp] = stack[indAddr];
+            stack[sp] = memoryAt(indAddr);
         }
+        template <bool tracing>
         void indexedAccess() {
             int tsval = getValue(stack[sp]);
-            int scale = getInteger(current().operand); 
+            int scale = current().operand; 
             int base = getValue(stack[sp-1]);
-            int ixAddr = 0;
-            if (base > MAX_GLOBAL_ADDR) {
-                ixAddr = base - (tsval * scale);
-            } else {
-                ixAddr = base + (tsval * scale);
-            }
-            if (should_trace) {
+            int ixAddr = base + (tsval * scale);
+            if (tracing) {
                 cout<<"Base Addr: "<<base<<", Scaling: "<<scale<<", offset : "<<tsval<<endl;
                 cout<<"Indexed Address: "<<ixAddr<<endl;
             }
             sp -= 1;
             stack[sp] = makeInt(ixAddr);
         }
+        template <bool tracing>
         void storeDestructive() {
             int addr = getValue(stack[sp-1]);
-            if (should_trace) {
+            if (tracing) {
                 cout<<"Calculated ad: "<<addr<<endl;
             }
-            stack[addr] = stack[sp];
+            memoryAt(addr) = stack[sp];
             sp -= 2;
         }
+        template <bool tracing>
         void matchRegExp() {
-            string pattern = string(getString(stack[sp--])->str);
-            string text = string(getString(stack[sp--])->str);
-            cout<<"text: "<<text<<endl;
-            cout<<"Pattern: "<<pattern<<endl;
-            NFACompiler reCompiler;
-            NFA nfa = reCompiler.compile(pattern);
-            RegExPatternMatcher pm(nfa, should_trace);
-            stack[++sp] = makeBool(pm.match(text));
+            int literal = current().operand;
+            string pattern = literal < 0 ? toStdString(stack[sp--]):"";
+            string text = toStdString(stack[sp--]);
+            if (tracing) {
+                cout<<"text: "<<text<<endl;
+                cout<<"Pattern: "<<(literal < 0 ? pattern:"literal #" + to_string(literal))<<endl;
+            }
+            CompiledRegEx& re = literal < 0 ? regexCache.get(pattern):patterns[literal];
+            bool result;
+            if (tracing) {
+                RegExPatternMatcher pm(re.nfa, tracing);
+                result = pm.match(text);
+            } else {
+                result = re.dfa.match(text);
+            }
+            sp += 1;
+            checkStack();
+            stack[sp] = makeBool(result);
         }
+        template <bool tracing>
         void storeParam() {
-            int addr = calculateAddress(getValue(stack[sp]));
-            stack[addr] = stack[sp-1];
+            int addr = calculateAddress<tracing>(getValue(stack[sp]));
+            memoryAt(addr) = stack[sp-1];
             sp -= 2;
         }
+        template <bool tracing>
         void storeNonDestructive() {
             //int addr = calculateAddress(getValue(stack[sp-1]));
             int addr = getValue(stack[sp-1]);
-            if (should_trace) {
+            if (tracing) {
                 cout<<"Calculated ad: "<<addr<<endl;
             }
-            stack[addr] = stack[sp];
+            memoryAt(addr) = stack[sp];
             stack[sp-1] = stack[sp];
             sp -= 1;
         }
         void markStack() {
-            stack[sp+1] = makeInt(bp); dl = sp+1;  //dynamic link
-            stack[sp+2] = makeInt(bp); sl = sp+2;  //static link
-            stack[sp+3] = makeInt(ip); ra = sp+3;  //return address
-            bp = sp+1;                             //set new base ptr
+            int fp = sp+1;
             sp += 4;                               //advance stack ptr
+            checkStack();
+            stack[fp] = makeInt(bp); dl = fp;      //dynamic link
+            stack[fp+1] = makeInt(bp); sl = fp+1;  //static link
+            stack[fp+2] = makeInt(ip); ra = fp+2;  //return address
+            bp = fp;                               //set new base ptr
         }
+        //the callee's lexical depth comes in the nestlevel of CAL and RET,
+        //the display entry it replaces is saved in the frame's last slot.
         void callProcedure() {
+            int depth = current().nestlevel;
             stack[bp+2] = makeInt(ip); ra = bp+2;   //update return address
-            ip = getInteger(current().operand);     //set instruction ptr
+            stack[bp+3] = makeInt(display[depth]);  //save display entry
+            display[depth] = bp;
+            ip = current().operand;     //set instruction ptr
+        }
+        //A self call in tail position reuses the caller's frame: the arguments
+        //are moved down over its parameters, its locals are cleared as INC
+        //would clear them, and the procedure is entered again. The number of
+        //arguments comes in nestlevel, the number of locals in aux.
+        void tailCall() {
+            int args = current().nestlevel;
+            int params = bp + SF_SLOTS;
+            for (int i = 0; i < args; i++)
+                stack[params+i] = stack[sp-args+1+i];
+            sp = params + args - 1;
+            for (int i = 0; i < current().aux; i++) {
+                sp += 1;
+                checkStack();
+                stack[sp] = makeInt(0);
+            }
+            ip = current().operand;
         }
         void returnFromProcedure() {
+            display[current().nestlevel] = getInteger(stack[bp+3]);
             stack[bp] = stack[sp];          //put return value at space saved for it
             sp = bp;                        //reset stack ptr
             ip = getInteger(stack[bp+2]);   //reset instruction ptr;
@@ -200,130 +346,451 @@ class PCodeVM {
             sl = bp+1;                      //static link
             ra = bp+2;                      //return address
         }
+        //int op int is by far the common case, so it is checked here and
+        //goes straight to the integer path without the generic promotion.
+        template <Value (*intop)(int, int), Value (*op)(Value, Value)>
         void binaryOperator() {
-            switch (current().instruction) {
-                case ADD: {
-                    sp -= 1;
-                    stack[sp] = Add(stack[sp], stack[sp+1]);
-                } break;
-                case SUB: {
-                    sp -= 1;
-                    stack[sp] = Sub(stack[sp], stack[sp+1]);
-                } break;
-                case MUL: {
-                    sp -= 1;
-                    stack[sp] = Mul(stack[sp], stack[sp+1]);
-                } break;
-                case DIV: {
-                    sp -= 1;
-                    stack[sp] = Div(stack[sp], stack[sp+1]);
-                } break;
-                case EQU:{
-                    sp -= 1;
-                    stack[sp] = equ(stack[sp], stack[sp+1]);
-                } break;
-                case NEQ: {
-                    sp -= 1;
-                    stack[sp] = neq(stack[sp], stack[sp+1]);
-                } break;
-                case LTE: {
-                    sp -= 1;
-                    stack[sp] = lte(stack[sp], stack[sp+1]);
-                } break;
-                case GTE: {
-                    sp -= 1;
-                    stack[sp] = gte(stack[sp], stack[sp+1]);
-                } break;
-                case LT: {
-                    sp -= 1;
-                    stack[sp] = lt(stack[sp], stack[sp+1]);
-                } break;
-                case GT: {
-                    sp -= 1;
-                    stack[sp] = gt(stack[sp], stack[sp+1]);
-                } break;
-            };
+            sp -= 1;
+            if (bothInts(stack[sp], stack[sp+1]))
+                stack[sp] = intop(getInteger(stack[sp]), getInteger(stack[sp+1]));
+            else
+                stack[sp] = op(stack[sp], stack[sp+1]);
+        }
+        template <bool tracing, Value (*op)(Value, Value)>
+        void updateVariable() {
+            int addr = calculateAddress<tracing>(current().operand);
+            operandAt(addr) = op(operandAt(addr), makeInt(current().aux));
+        }
+        template <bool tracing, Value (*op)(Value, Value)>
+        void loadAndApplyConstant() {
+            int addr = calculateAddress<tracing>(current().operand);
+            sp += 1;
+            checkStack();
+            stack[sp] = op(operandAt(addr), makeInt(current().aux));
+        }
+        template <Value (*op)(Value, Value)>
+        void applyConstant() {
+            stack[sp] = op(stack[sp], makeInt(current().operand));
+        }
+        template <bool tracing, Value (*op)(Value, Value)>
+        void applyVariable() {
+            int addr = calculateAddress<tracing>(current().operand);
+            stack[sp] = op(stack[sp], operandAt(addr));
+        }
+        template <Value (*relop)(Value, Value)>
+        void compareAndBranch() {
+            Value result = relop(stack[sp-1], stack[sp]);
+            sp -= 2;
+            stack[sp+1] = makeInt(0);
+            if (getBoolean(result) == false)
+                ip = current().operand;
+        }
+        //operands of the typed forms are known to be numbers, which leaves
+        //only int or real to tell apart, not strings, bools and the rest
+        template <Value (*intop)(int, int), Value (*realop)(double, double)>
+        void numericOperator() {
+            sp -= 1;
+            if (bothInts(stack[sp], stack[sp+1]))
+                stack[sp] = intop(getInteger(stack[sp]), getInteger(stack[sp+1]));
+            else
+                stack[sp] = realop(numberOf(stack[sp]), numberOf(stack[sp+1]));
+        }
+        template <Value (*intop)(int, int), Value (*realop)(double, double)>
+        void numericCompareAndBranch() {
+            Value result;
+            if (bothInts(stack[sp-1], stack[sp]))
+                result = intop(getInteger(stack[sp-1]), getInteger(stack[sp]));
+            else
+                result = realop(numberOf(stack[sp-1]), numberOf(stack[sp]));
+            sp -= 2;
+            stack[sp+1] = makeInt(0);
+            if (getBoolean(result) == false)
+                ip = current().operand;
         }
         void incTop() {
-            for (int i = 0; i < getInteger(current().operand); i++) {
-                stack[++sp] = makeInt(0);
+            for (int i = 0; i < current().operand; i++) {
+                sp += 1;
+                checkStack();
+                stack[sp] = makeInt(0);
             }
         }
+        //drops what a call made as a statement left
+        void decTop() {
+            sp -= current().operand;
+        }
         void pushSP() {
             sp += 1;
+            checkStack();
             stack[sp] = makeInt(sp);
         }
         inline void nop() { }
+        void markValues(vector<Value>& region, int count) {
+            for (int i = 0; i < count; i++)
+                markValue(region[i]);
+        }
+        //Loop back edges and calls are the safe points, where the strings in
+        //use are all in the stack, the globals, the records or the constants,
+        //and so is every instruction native code hands back. The slots above
+        //sp that have been used are marked as well, rather than assumed dead.
+        void collectGarbage() {
+            stringHeap.beginCollection();
+            markValues(stack, stackTop+1);
+            markValues(globals, globals.size());
+            markValues(heap, heap.size());
+            markValues(constants, constants.size());
+            markValue(badAddress);
+            stringHeap.sweep();
+        }
+        inline void safePoint() {
+            if (stringHeap.wantsCollection())
+                collectGarbage();
+        }
+#ifdef DALGOL_JIT
+        //native code works on the same stack, in byte offsets
+        void toJit() {
+            jitContext.stack = stack.data();
+            jitContext.sp = (int64_t)sp*sizeof(Value);
+            jitContext.bp = (int64_t)bp*sizeof(Value);
+            jitContext.stackTop = (int64_t)stackTop*sizeof(Value);
+            jitContext.globals = globals.data();
+            jitContext.globalsSize = globals.size();
+            jitContext.display = display;
+            jitContext.vm = this;
+        }
+        void fromJit() {
+            sp = jitContext.sp/sizeof(Value);
+            bp = jitContext.bp/sizeof(Value);
+        }
+        //everything but control flow, for native code to hand back one
+        //instruction it has no fast path for
+        void stepInstruction() {
+            switch (current().instruction) {
+                case LDC: loadConstant(); break;
+                case LDK: loadPooledConstant(); break;
+                case LOD: loadFromAddress<false>(); break;
+                case LDA: loadAddress<false>(); break;
+                case LRP: loadReferenceParam(); break;
+                case LDP: loadParam(); break;
+                case LDF: loadField(); break;
+                case LDI: indirectLoad<false>(); break;
+                case IXA: indexedAccess<false>(); break;
+                case STO: storeDestructive<false>(); break;
+                case STP: storeParam<false>(); break;
+                case STN: storeNonDestructive<false>(); break;
+                case TCL: tailCall(); break;
+                case NEG: stack[sp] = Neg(stack[sp]); break;
+                case NOT: stack[sp] = Not(stack[sp]); break;
+                case PRINT: cout<<"\t\t\t\t\t"<<toStdString(stack[sp--])<<endl; break;
+                case MATCHRE: matchRegExp<false>(); break;
+                case INC: incTop(); break;
+                case DEC: decTop(); break;
+                case TS: pushSP(); break;
+                case ADD: binaryOperator<addInt, Add>(); break;
+                case SUB: binaryOperator<subInt, Sub>(); break;
+                case MUL: binaryOperator<mulInt, Mul>(); break;
+                case DIV: binaryOperator<divInt, Div>(); break;
+                case EQU: binaryOperator<equInt, equ>(); break;
+                case NEQ: binaryOperator<neqInt, neq>(); break;
+                case LTE: binaryOperator<lteInt, lte>(); break;
+                case GTE: binaryOperator<gteInt, gte>(); break;
+                case LT: binaryOperator<ltInt, lt>(); break;
+                case GT: binaryOperator<gtInt, gt>(); break;
+                case INCV: updateVariable<false, Add>(); break;
+                case DECV: updateVariable<false, Sub>(); break;
+                case LADD: loadAndApplyConstant<false, Add>(); break;
+                case LSUB: loadAndApplyConstant<false, Sub>(); break;
+                case ADDC: applyConstant<Add>(); break;
+                case SUBC: applyConstant<Sub>(); break;
+                case MULC: applyConstant<Mul>(); break;
+                case ADDL: applyVariable<false, Add>(); break;
+                case SUBL: applyVariable<false, Sub>(); break;
+                case MULL: applyVariable<false, Mul>(); break;
+                case EQUJ: compareAndBranch<equ>(); break;
+                case NEQJ: compareAndBranch<neq>(); break;
+                case LTEJ: compareAndBranch<lte>(); break;
+                case GTEJ: compareAndBranch<gte>(); break;
+                case LTJ: compareAndBranch<lt>(); break;
+                case GTJ: compareAndBranch<gt>(); break;
+                case NADD: numericOperator<addInt, addReal>(); break;
+                case NSUB: numericOperator<subInt, subReal>(); break;
+                case NMUL: numericOperator<mulInt, mulReal>(); break;
+                case NEQU: numericOperator<equInt, equReal>(); break;
+                case NNEQ: numericOperator<neqInt, neqReal>(); break;
+                case NLTE: numericOperator<lteInt, lteReal>(); break;
+                case NGTE: numericOperator<gteInt, gteReal>(); break;
+                case NLT: numericOperator<ltInt, ltReal>(); break;
+                case NGT: numericOperator<gtInt, gtReal>(); break;
+                case CAT: sp -= 1; stack[sp] = concatValues(stack[sp], stack[sp+1]); break;
+                case NEQUJ: numericCompareAndBranch<equInt, equReal>(); break;
+                case NNEQJ: numericCompareAndBranch<neqInt, neqReal>(); break;
+                case NLTEJ: numericCompareAndBranch<lteInt, lteReal>(); break;
+                case NGTEJ: numericCompareAndBranch<gteInt, gteReal>(); break;
+                case NLTJ: numericCompareAndBranch<ltInt, ltReal>(); break;
+                case NGTJ: numericCompareAndBranch<gtInt, gtReal>(); break;
+                default: break;
+            }
+        }
+        //runs the instruction at at for native code, returns whether it branched
+        static int jitStep(JitContext* ctx, int at) {
+            PCodeVM* vm = (PCodeVM*)ctx->vm;
+            vm->fromJit();
+            vm->safePoint();
+            vm->curr = &vm->codePage[at];
+            vm->ip = at+1;
+            vm->stepInstruction();
+            vm->toJit();
+            return vm->ip != at+1;
+        }
+        static int jitGrow(JitContext* ctx, int) {
+            PCodeVM* vm = (PCodeVM*)ctx->vm;
+            vm->fromJit();
+            vm->checkStack();
+            vm->toJit();
+            return 0;
+        }
+#endif
+        //Calls, tail calls and loop back edges are where the interpreter
+        //counts towards compiling, and where it switches to native code
+        //once there is some. Returns whether the program halted in it.
+        template <bool tracing>
+        bool runNative(int at) {
+#ifdef DALGOL_JIT
+            if (tracing || !useJit)
+                return false;
+            uint8_t* native = jit.hot(at);
+            if (native == nullptr)
+                return false;
+            toJit();
+            int status = jit.run(&jitContext, native);
+            fromJit();
+            ip = jitContext.ip;
+            return status == JIT_HALTED;
+#else
+            return false;
+#endif
+        }
+        //profiling counts every instruction, so it
+        //leaves native code out as tracing does
+        template <bool tracing, bool profiling>
+        void run() {
+#ifdef DALGOL_COMPUTED_GOTO
+            static const void* dispatchTable[] = {
+                &&op_LDC, &&op_LDA, &&op_LOD, &&op_LRP,
+                &&op_LDP, &&op_LDI, &&op_LDF, &&op_IXA,
+                &&op_STO, &&op_STN, &&op_STP,
+                &&op_LAB, &&op_MST, &&op_ENT, &&op_CAL, &&op_TCL,
+                &&op_RET, &&op_JMP, &&op_JPC,
+                &&op_NEG, &&op_ADD, &&op_SUB,
+                &&op_MUL, &&op_DIV, &&op_MOD, &&op_NOT,
+                &&op_EQU, &&op_NEQ, &&op_LTE, &&op_GTE,
+                &&op_LT, &&op_GT, &&op_TS, &&op_INC, &&op_DEC,
+                &&op_MATCHRE,
+                &&op_PRINT, &&op_HALT,
+                &&op_INCV, &&op_DECV, &&op_LADD, &&op_LSUB,
+                &&op_ADDC, &&op_SUBC, &&op_MULC,
+                &&op_ADDL, &&op_SUBL, &&op_MULL,
+                &&op_EQUJ, &&op_NEQJ, &&op_LTEJ, &&op_GTEJ,
+                &&op_LTJ, &&op_GTJ,
+                &&op_NADD, &&op_NSUB, &&op_NMUL,
+                &&op_NEQU, &&op_NNEQ, &&op_NLTE, &&op_NGTE, &&op_NLT, &&op_NGT,
+                &&op_CAT,
+                &&op_NEQUJ, &&op_NNEQJ, &&op_NLTEJ, &&op_NGTEJ, &&op_NLTJ, &&op_NGTJ,
+                &&op_LDK
+            };
+            #define vmcase(op) op_##op:
+            #define vmnext() { if (tracing) printStack(); nextInstruction<tracing, profiling>(); goto *dispatchTable[current().instruction]; }
+            nextInstruction<tracing, profiling>();
+            goto *dispatchTable[current().instruction];
+#else
+            #define vmcase(op) case op:
+            #define vmnext() break
+            for (;;) {
+                nextInstruction<tracing, profiling>();
+                switch (current().instruction) {
+#endif
+                    vmcase(LAB) vmcase(ENT) { nop(); } vmnext();
+                    vmcase(JMP) {
+                        int from = ip-1;
+                        doJump();
+                        if (ip <= from) {
+                            safePoint();
+                            if (runNative<tracing || profiling>(ip))
+                                return;
+                        }
+                    } vmnext();
+                    vmcase(JPC) { jumpConditional(); } vmnext();
+                    vmcase(LDC) { loadConstant(); } vmnext();
+                    vmcase(LDK) { loadPooledConstant(); } vmnext();
+                    vmcase(LOD) { loadFromAddress<tracing>(); } vmnext();
+                    vmcase(LDA) { loadAddress<tracing>(); } vmnext();
+                    vmcase(LRP) { loadReferenceParam(); } vmnext();
+                    vmcase(LDP) { loadParam(); } vmnext();
+                    vmcase(LDF) { loadField(); } vmnext();
+                    vmcase(LDI) { indirectLoad<tracing>(); } vmnext();
+                    vmcase(IXA) { indexedAccess<tracing>(); } vmnext();
+                    vmcase(STO) { storeDestructive<tracing>(); } vmnext();
+                    vmcase(STP) { storeParam<tracing>(); } vmnext();
+                    vmcase(STN) { storeNonDestructive<tracing>(); } vmnext();
+                    vmcase(MST) { markStack(); } vmnext();
+                    vmcase(CAL) { callProcedure(); safePoint(); if (runNative<tracing || profiling>(ip)) return; } vmnext();
+                    vmcase(TCL) { tailCall(); safePoint(); if (runNative<tracing || profiling>(ip)) return; } vmnext();
+                    vmcase(RET) { returnFromProcedure(); } vmnext();
+                    vmcase(NEG) { stack[sp] = Neg(stack[sp]); } vmnext();
+                    vmcase(NOT) { stack[sp] = Not(stack[sp]); } vmnext();
+                    vmcase(PRINT) { cout<<"\t\t\t\t\t"<<toStdString(stack[sp--])<<endl; } vmnext();
+                    vmcase(MATCHRE) { matchRegExp<tracing>(); } vmnext();
+                    vmcase(INC) { incTop(); } vmnext();
+                    vmcase(TS) { pushSP(); } vmnext();
+                    vmcase(ADD) { binaryOperator<addInt, Add>(); } vmnext();
+                    vmcase(SUB) { binaryOperator<subInt, Sub>(); } vmnext();
+                    vmcase(MUL) { binaryOperator<mulInt, Mul>(); } vmnext();
+                    vmcase(DIV) { binaryOperator<divInt, Div>(); } vmnext();
+                    vmcase(EQU) { binaryOperator<equInt, equ>(); } vmnext();
+                    vmcase(NEQ) { binaryOperator<neqInt, neq>(); } vmnext();
+                    vmcase(LTE) { binaryOperator<lteInt, lte>(); } vmnext();
+                    vmcase(GTE) { binaryOperator<gteInt, gte>(); } vmnext();
+                    vmcase(LT) { binaryOperator<ltInt, lt>(); } vmnext();
+                    vmcase(GT) { binaryOperator<gtInt, gt>(); } vmnext();
+                    vmcase(MOD) { nop(); } vmnext();
+                    vmcase(DEC) { decTop(); } vmnext();
+                    vmcase(INCV) { updateVariable<tracing, Add>(); } vmnext();
+                    vmcase(DECV) { updateVariable<tracing, Sub>(); } vmnext();
+                    vmcase(LADD) { loadAndApplyConstant<tracing, Add>(); } vmnext();
+                    vmcase(LSUB) { loadAndApplyConstant<tracing, Sub>(); } vmnext();
+                    vmcase(ADDC) { applyConstant<Add>(); } vmnext();
+                    vmcase(SUBC) { applyConstant<Sub>(); } vmnext();
+                    vmcase(MULC) { applyConstant<Mul>(); } vmnext();
+                    vmcase(ADDL) { applyVariable<tracing, Add>(); } vmnext();
+                    vmcase(SUBL) { applyVariable<tracing, Sub>(); } vmnext();
+                    vmcase(MULL) { applyVariable<tracing, Mul>(); } vmnext();
+                    vmcase(EQUJ) { compareAndBranch<equ>(); } vmnext();
+                    vmcase(NEQJ) { compareAndBranch<neq>(); } vmnext();
+                    vmcase(LTEJ) { compareAndBranch<lte>(); } vmnext();
+                    vmcase(GTEJ) { compareAndBranch<gte>(); } vmnext();
+                    vmcase(LTJ) { compareAndBranch<lt>(); } vmnext();
+                    vmcase(GTJ) { compareAndBranch<gt>(); } vmnext();
+                    vmcase(NADD) { numericOperator<addInt, addReal>(); } vmnext();
+                    vmcase(NSUB) { numericOperator<subInt, subReal>(); } vmnext();
+                    vmcase(NMUL) { numericOperator<mulInt, mulReal>(); } vmnext();
+                    vmcase(NEQU) { numericOperator<equInt, equReal>(); } vmnext();
+                    vmcase(NNEQ) { numericOperator<neqInt, neqReal>(); } vmnext();
+                    vmcase(NLTE) { numericOperator<lteInt, lteReal>(); } vmnext();
+                    vmcase(NGTE) { numericOperator<gteInt, gteReal>(); } vmnext();
+                    vmcase(NLT) { numericOperator<ltInt, ltReal>(); } vmnext();
+                    vmcase(NGT) { numericOperator<gtInt, gtReal>(); } vmnext();
+                    vmcase(CAT) { sp -= 1; stack[sp] = concatValues(stack[sp], stack[sp+1]); } vmnext();
+                    vmcase(NEQUJ) { numericCompareAndBranch<equInt, equReal>(); } vmnext();
+                    vmcase(NNEQJ) { numericCompareAndBranch<neqInt, neqReal>(); } vmnext();
+                    vmcase(NLTEJ) { numericCompareAndBranch<lteInt, lteReal>(); } vmnext();
+                    vmcase(NGTEJ) { numericCompareAndBranch<gteInt, gteReal>(); } vmnext();
+                    vmcase(NLTJ) { numericCompareAndBranch<ltInt, ltReal>(); } vmnext();
+                    vmcase(NGTJ) { numericCompareAndBranch<gtInt, gtReal>(); } vmnext();
+                    vmcase(HALT) { return; }
+#ifndef DALGOL_COMPUTED_GOTO
+                }
+                if (tracing)
+                    printStack();
+            }
+#endif
+            #undef vmcase
+            #undef vmnext
+        }
     public:
+#ifdef DALGOL_JIT
+        PCodeVM(bool trace = false) : jit(jitStep, jitGrow) {
+#else
         PCodeVM(bool trace = false) {
+#endif
+            useJit = true;
+            useProfile = false;
+            badAddress = makeNil();
+            globalsEnd = GLOBAL_BASE;
+            heapEnd = HEAP_BASE;
             ip = 0;
             bp = 1;
             dl = 1;
             sl = 2;
             ra = 3;
             sp = 4;
-            stack.reserve(MAX_STACK);
-            codePage.reserve(MAX_STACK);
+            stackTop = sp;
+            stack = vector<Value>(INITIAL_STACK);
+            for (int i = 0; i < MAX_DEPTH; i++)
+                display[i] = bp;
             should_trace = trace;
         }
         void setTrace(bool trace) {
             should_trace = trace;
         }
         void init(vector<Instruction>& code) {
-            for (int i = 0; i < code.size(); i++)
-                codePage[i] = code[i];
+            decodeCodePage(code, codePage, constants);
+            reserveMemory();
+            compilePatterns();
+#ifdef DALGOL_JIT
+            jit.load(codePage, constants);
+#endif
+            if (useProfile)
+                profiler.load(codePage, constants);
             if (ip > 0) ip--;
-            curr = codePage[ip];
+            curr = &codePage[ip];
         }
         void execute() {
-            while (current().instruction != HALT) {
-                nextInstruction();
-                switch(current().instruction) {
-                    case LAB: { nop(); } break;
-                    case JMP: { doJump(); } break;
-                    case JPC: { jumpConditional(); } break;
-                    case LDC: { loadConstant(); } break;
-                    case LOD: { loadFromAddress(); } break;
-                    case LDA: { loadAddress(); } break;
-                    case LRP: { loadReferenceParam(); } break;
-                    case LDP: { loadParam(); } break;
-                    case LDF: { loadField(); } break;
-                    case LDI: { indirectLoad(); } break;
-                    case IXA: { indexedAccess(); } break;
-                    case STO: { storeDestructive(); } break;
-                    case STP: { storeParam(); } break;
-                    case STN: { storeNonDestructive(); } break;
-                    case MST: { markStack(); } break;
-                    case CAL: { callProcedure(); } break;
-                    case ENT: { nop(); } break;
-                    case RET: { returnFromProcedure(); } break;
-                    case NEG: { stack[sp] = Neg(stack[sp]); } break;
-                    case NOT: { stack[sp] = Not(stack[sp]); } break;
-                    case PRINT: { cout<<"\t\t\t\t\t"<<*toString(stack[sp--])<<endl; } break;
-                    case MATCHRE: { matchRegExp(); } break;
-                    case INC: { incTop(); } break;
-                    case TS: {
-                        pushSP();
-                    } break;
-                    case HALT:
-                        break;
-                    default:    
-                        binaryOperator();
-                        break;
-                }
-                if (should_trace && current().instruction != HALT)
-                    printStack();
-                        
+            stringHeap.setManaged(true);
+            if (should_trace) {
+                run<true, false>();
+            } else if (useProfile) {
+                run<false, true>();
+                profiler.stop();
+            } else {
+                run<false, false>();
             }
+            stringHeap.setManaged(false);
+        }
+        //native code is only ever run when neither tracing nor profiling
+        void setJit(bool enabled) {
+#ifdef DALGOL_JIT
+            useJit = enabled && jit.available();
+#else
+            useJit = false;
+#endif
+        }
+        void printJitStats() {
+#ifdef DALGOL_JIT
+            if (useJit && !should_trace && !useProfile)
+                jit.printStats();
+#endif
+        }
+        //the profile is only taken when not tracing
+        void setProfile(bool enabled) {
+            useProfile = enabled;
+        }
+        void printProfile() {
+            if (useProfile && !should_trace)
+                profiler.report();
+        }
+        //set before init(), it sizes the globals and the heap
+        void setMemoryExtent(int globalsEndAddr, int heapEndAddr) {
+            globalsEnd = globalsEndAddr;
+            heapEnd = heapEndAddr;
+        }
+        void setHeapLimit(size_t maxBytes) {
+            stringHeap.setLimit(maxBytes);
+        }
+        void printGCStats() {
+            stringHeap.printStats();
+        }
+        void printRegExStats() {
+            regexCache.printStats();
+        }
+        int stackHighWater() {
+            return stackTop;
         }
-       
         void printStack() {
             int arn = 0;
             cout<<"[---------------------------------------------------]"<<endl;
             cout<<"{ \n";
             cout<<"  BP: "<<bp<<", SP: "<<sp<<endl;
             cout<<"      Stack:         \t\t\tGlobals: "<<endl;
-            for (int i = 0, j = 5000; i <= sp; i++, j--) {
+            for (int i = 0; i <= sp; i++) {
                 if (i == bp) cout<<" BP: ";
                 if (i == sp) cout<<" SP: ";
                 if (i == sl) cout<<" SL: ";
@@ -333,7 +800,9 @@ class PCodeVM {
                     cout<<"     ";
                 cout<<"["<<setw(4)<<i<<": "<<setw(15)<<*toString(stack[i])<<"] ";
                 cout<<"\t\t";
-                cout<<"["<<setw(4)<<j<<": "<<setw(15)<<*toString(stack[j])<<"] "<<endl;
+                if (i < globals.size())
+                    cout<<"["<<setw(4)<<i<<": "<<setw(15)<<*toString(globals[i])<<"] ";
+                cout<<endl;
 
             }
             cout<<"}"<<endl;
@@ -0,0 +1,159 @@
+#ifndef profiler_hpp
+#define profiler_hpp
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "value.hpp"
+#include "vminst.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define DALGOL_RDTSC
+#endif
+using namespace std;
+
+const int NUM_OPCODES = LDK+1;
+const int PROFILE_TOP = 15; //rows in each table of the report
+
+//the time stamp counter where there is one, nanoseconds otherwise
+inline uint64_t profileClock() {
+#ifdef DALGOL_RDTSC
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#ifdef DALGOL_RDTSC
+const string PROFILE_UNIT = "cycles";
+#else
+const string PROFILE_UNIT = "ns";
+#endif
+
+//Counts the executions of every instruction in the code page, and the
+//time from its fetch to the fetch of the next one, which includes the
+//dispatch. The report adds them up by procedure and by opcode. A named
+//ENT starts a procedure and a plain one a block, each ends at its RET,
+//blocks and anything outside a procedure count towards "(main)".
+class Profiler {
+    private:
+        vector<VMInstruction>* code;
+        vector<Value>* constants;
+        vector<uint64_t> counts;
+        vector<uint64_t> cycles;
+        vector<int> owner; //index into names of the procedure holding each instruction
+        vector<string> names;
+        int last;
+        uint64_t stamp;
+        void findProcedures() {
+            owner.assign(code->size(), 0);
+            names.assign(1, "(main)");
+            vector<int> scopes; //procedure each open ENT belongs to
+            for (int at = 0; at < code->size(); at++) {
+                VMInstruction& inst = (*code)[at];
+                int current = scopes.empty() ? 0:scopes.back();
+                if (inst.instruction == ENT) {
+                    Value name = (*constants)[inst.operand];
+                    if (typeOf(name) == AS_STRING) {
+                        names.push_back(toStdString(name));
+                        current = names.size()-1;
+                    }
+                    scopes.push_back(current);
+                }
+                owner[at] = current;
+                if (inst.instruction == RET && !scopes.empty())
+                    scopes.pop_back();
+            }
+        }
+        string describe(int at) {
+            VMInstruction& inst = (*code)[at];
+            string operand = to_string(inst.operand);
+            if (inst.instruction == LDK || inst.instruction == LAB || inst.instruction == ENT)
+                operand = toStdString((*constants)[inst.operand]);
+            return instStr[inst.instruction] + " " + operand + " " + to_string(inst.nestlevel);
+        }
+        double percent(uint64_t part, uint64_t whole) {
+            return whole == 0 ? 0:100.0*part/whole;
+        }
+        //indices of the n largest of by, largest first
+        vector<int> hottest(vector<uint64_t>& by, int n) {
+            vector<int> order;
+            for (int i = 0; i < by.size(); i++)
+                if (by[i] > 0)
+                    order.push_back(i);
+            sort(order.begin(), order.end(), [&](int a, int b) { return by[a] > by[b]; });
+            if (order.size() > n)
+                order.resize(n);
+            return order;
+        }
+    public:
+        Profiler() {
+            code = nullptr;
+            constants = nullptr;
+            last = -1;
+            stamp = 0;
+        }
+        void load(vector<VMInstruction>& codePage, vector<Value>& pool) {
+            code = &codePage;
+            constants = &pool;
+            counts.assign(code->size(), 0);
+            cycles.assign(code->size(), 0);
+            findProcedures();
+            last = -1;
+        }
+        //the time since the last call belongs to the instruction fetched then
+        inline void enter(int at) {
+            uint64_t now = profileClock();
+            if (last >= 0)
+                cycles[last] += now - stamp;
+            counts[at]++;
+            last = at;
+            stamp = now;
+        }
+        void stop() {
+            if (last >= 0)
+                cycles[last] += profileClock() - stamp;
+            last = -1;
+        }
+        void report() {
+            if (code == nullptr)
+                return;
+            uint64_t totalCount = 0, totalCycles = 0;
+            vector<uint64_t> procCount(names.size(), 0), procCycles(names.size(), 0);
+            vector<uint64_t> opCount(NUM_OPCODES, 0), opCycles(NUM_OPCODES, 0);
+            for (int at = 0; at < code->size(); at++) {
+                totalCount += counts[at];
+                totalCycles += cycles[at];
+                procCount[owner[at]] += counts[at];
+                procCycles[owner[at]] += cycles[at];
+                opCount[(*code)[at].instruction] += counts[at];
+                opCycles[(*code)[at].instruction] += cycles[at];
+            }
+            cout<<"Profile: "<<totalCount<<" instructions executed in "<<totalCycles<<" "<<PROFILE_UNIT<<"."<<endl;
+            cout<<fixed<<setprecision(1);
+            cout<<"Hottest instructions:"<<endl;
+            cout<<setw(8)<<"addr"<<"  "<<left<<setw(24)<<"instruction"<<right<<setw(12)<<"count"<<setw(14)<<PROFILE_UNIT<<setw(8)<<"%"<<"  procedure"<<endl;
+            for (int at : hottest(cycles, PROFILE_TOP)) {
+                cout<<setw(8)<<at<<"  "<<left<<setw(24)<<describe(at)<<right<<setw(12)<<counts[at]<<setw(14)<<cycles[at];
+                cout<<setw(8)<<percent(cycles[at], totalCycles)<<"  "<<names[owner[at]]<<endl;
+            }
+            cout<<"Hottest procedures:"<<endl;
+            cout<<"  "<<left<<setw(30)<<"procedure"<<right<<setw(12)<<"count"<<setw(14)<<PROFILE_UNIT<<setw(8)<<"%"<<endl;
+            for (int p : hottest(procCycles, PROFILE_TOP)) {
+                cout<<"  "<<left<<setw(30)<<names[p]<<right<<setw(12)<<procCount[p]<<setw(14)<<procCycles[p];
+                cout<<setw(8)<<percent(procCycles[p], totalCycles)<<endl;
+            }
+            cout<<"Opcode mix:"<<endl;
+            cout<<"  "<<left<<setw(8)<<"opcode"<<right<<setw(12)<<"count"<<setw(8)<<"%"<<setw(14)<<PROFILE_UNIT<<setw(8)<<"%"<<setw(10)<<"average"<<endl;
+            for (int op : hottest(opCount, NUM_OPCODES)) {
+                cout<<"  "<<left<<setw(8)<<instStr[op]<<right<<setw(12)<<opCount[op]<<setw(8)<<percent(opCount[op], totalCount);
+                cout<<setw(14)<<opCycles[op]<<setw(8)<<percent(opCycles[op], totalCycles)<<setw(10)<<(double)opCycles[op]/opCount[op]<<endl;
+            }
+            cout<<defaultfloat<<setprecision(6);
+        }
+};
+
+#endif
\ No newline at end of file
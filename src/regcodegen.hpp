@@ -0,0 +1,589 @@
+#ifndef regcodegen_hpp
+#define regcodegen_hpp
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "syntaxtree.hpp"
+#include "scoping_st.hpp"
+#include "reginst.hpp"
+using namespace std;
+
+//Generates code for RegisterVM from the same AST and symbol table as
+//PCodeGenerator. Locals live in registers of their procedure's frame, so
+//an expression over them compiles to one three address instruction per
+//operator, and an assignment computes straight into its target.
+//
+//What a procedure returns is what the P-machine would find on top of its
+//stack at RET: the value of the last return, let or expression statement
+//it ran (RES records it), or else its last parameter or local.
+//
+//Records, refs, local arrays and lets without an initializer aren't
+//handled, generate() says so and leaves the program to the P-machine.
+class RegisterCodeGenerator {
+    private:
+        struct ProcContext {
+            int proc;
+            int depth;
+            int tempBase;
+            int top;
+            unordered_map<string, int> constants; //key of the value to its register
+        };
+        bool should_trace;
+        ScopingSymbolTable st;
+        RegProgram* program;
+        vector<ProcContext> contexts;
+        unordered_map<string, int> procIndex;
+        unordered_map<string, vector<int>> pendingCalls;
+        unordered_set<ASTNode*> resultCalls; //as on the P-machine, the rest are dropped
+        int globalsSize;
+        string failure;
+        vector<RegInstruction>& code() {
+            return program->code;
+        }
+        ProcContext& cur() {
+            return contexts.back();
+        }
+        RegProcedure& curProc() {
+            return program->procedures[cur().proc];
+        }
+        int emit(RegOp op, int a = 0, int b = 0, int c = 0, int n = 0) {
+            code().push_back(RegInstruction(op, a, b, c, n));
+            return code().size()-1;
+        }
+        int temp() {
+            int r = cur().top++;
+            if (cur().top > curProc().frameSize)
+                curProc().frameSize = cur().top;
+            return r;
+        }
+        int into(int dst) {
+            return dst >= 0 ? dst:temp();
+        }
+        bool isStmt(ASTNode* node, StmtType type) {
+            return node != nullptr && node->nk == STMT_NODE && node->type.stmt == type;
+        }
+        bool isExpr(ASTNode* node, ExprType type) {
+            return node != nullptr && node->nk == EXPR_NODE && node->type.expr == type;
+        }
+        bool isUpdate(ASTNode* node) {
+            return isExpr(node, ASSIGN_EXPR) || (isExpr(node, UNOP_EXPR) &&
+                  (node->data.symbol == TK_POST_INC || node->data.symbol == TK_POST_DEC));
+        }
+        bool hasSubscript(ASTNode* node) {
+            return isExpr(node->child[0], SUBSCRIPT_EXPR);
+        }
+        //whether evaluating node could change a variable
+        bool hasEffects(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isUpdate(node) || isExpr(node, FUNC_EXPR))
+                    return true;
+                for (int i = 0; i < MAXCHILD; i++)
+                    if (hasEffects(node->child[i]))
+                        return true;
+            }
+            return false;
+        }
+        string findUnsupported(ASTNode* node, bool inProcedure) {
+            for (; node != nullptr; node = node->next) {
+                if (node->nk == STMT_NODE) {
+                    switch (node->type.stmt) {
+                        case STRUCT_STMT: return "records";
+                        case REF_STMT: return "ref parameters";
+                        case BLOCK_STMT: return "blocks";
+                        case LET_STMT: {
+                            if (node->child[0] == nullptr)
+                                return "let without an initializer";
+                            if (hasSubscript(node) && inProcedure)
+                                return "local arrays";
+                        } break;
+                        case FUNC_DEF_STMT: {
+                            for (ASTNode* p = node->child[0]; p != nullptr; p = p->next)
+                                if (isStmt(p, REF_STMT))
+                                    return "ref parameters";
+                            string what = findUnsupported(node->child[1], true);
+                            if (!what.empty())
+                                return what;
+                            continue;
+                        }
+                        default:
+                            break;
+                    }
+                } else {
+                    switch (node->type.expr) {
+                        case FIELD_EXPR:
+                        case BLESS_EXPR:
+                            return "records";
+                        case BINOP_EXPR: {
+                            int op = node->data.symbol;
+                            if (op != TK_ADD && op != TK_SUB && op != TK_MUL && op != TK_DIV)
+                                return "operator " + node->data.strval;
+                        } break;
+                        default:
+                            break;
+                    }
+                }
+                for (int i = 0; i < MAXCHILD; i++) {
+                    string what = findUnsupported(node->child[i], inProcedure);
+                    if (!what.empty())
+                        return what;
+                }
+            }
+            return "";
+        }
+        void buildST(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, LET_STMT)) {
+                    int size = hasSubscript(node) ? atoi(node->child[0]->data.strval.data()):1;
+                    st.insertVar(node->data.strval, size);
+                    LocalVar* lv = st.getVar(node->data.strval);
+                    if (isGlobalAddr(lv->loc))
+                        globalsSize = max(globalsSize, lv->loc - GLOBAL_BASE + max(size, 1));
+                } else if (isStmt(node, FUNC_DEF_STMT)) {
+                    st.openScope(node->data.strval);
+                    buildST(node->child[0]);
+                    buildST(node->child[1]);
+                    st.closeScope();
+                    continue;
+                } else if (isExpr(node, ID_EXPR) && st.getVar(node->data.strval) == nullptr) {
+                    cout<<"Error: undeclared ass variable trying to be used: "<<node->data.strval<<endl;
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    buildST(node->child[i]);
+            }
+        }
+        string constantKey(Value val) {
+            char bits[32];
+            switch (typeOf(val)) {
+                case AS_STRING: return "s:" + toStdString(val);
+                case AS_REAL: snprintf(bits, sizeof(bits), "r:%a", getReal(val)); return bits;
+                default: break;
+            }
+            return to_string(typeOf(val)) + ":" + toStdString(val);
+        }
+        void addConstant(Value val) {
+            string key = constantKey(val);
+            if (cur().constants.count(key))
+                return;
+            RegProcedure& proc = curProc();
+            cur().constants[key] = proc.numSlots + proc.constants.size();
+            proc.constants.push_back(val);
+        }
+        //the constants of the procedure's own code, nested
+        //procedures load their own
+        void collectConstants(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, FUNC_DEF_STMT))
+                    continue;
+                if (isExpr(node, CONST_EXPR))
+                    addConstant(node->value);
+                else if (isExpr(node, STR_EXPR))
+                    addConstant(makeString(node->data.strval));
+                else if (isUpdate(node) && !isExpr(node, ASSIGN_EXPR))
+                    addConstant(makeInt(1));
+                for (int i = 0; i < MAXCHILD; i++)
+                    collectConstants(node->child[i]);
+            }
+        }
+        int constantReg(Value val) {
+            return cur().constants[constantKey(val)];
+        }
+        void openProcedure(string name, ASTNode* body, int numSlots) {
+            ProcContext ctx;
+            ctx.proc = program->procedures.size();
+            ctx.depth = name.empty() ? 0:st.scopeLevel(name);
+            program->procedures.push_back(RegProcedure(name, ctx.depth));
+            contexts.push_back(ctx);
+            curProc().entry = code().size();
+            curProc().numSlots = numSlots;
+            collectConstants(body);
+            cur().tempBase = cur().top = numSlots + curProc().constants.size();
+            curProc().frameSize = cur().top;
+            emit(RENT, cur().proc);
+        }
+        //the register a variable can be computed straight into, or
+        //-1 if it belongs to another frame
+        int registerOf(LocalVar* lv) {
+            if (isGlobalAddr(lv->loc))
+                return cur().depth == 0 ? lv->loc - GLOBAL_BASE:-1;
+            return lv->depth == cur().depth ? lv->loc:-1;
+        }
+        int readVar(LocalVar* lv, int dst) {
+            int reg = registerOf(lv);
+            if (reg >= 0) {
+                if (dst >= 0 && dst != reg)
+                    emit(RMOV, dst, reg);
+                return dst >= 0 ? dst:reg;
+            }
+            int d = into(dst);
+            if (isGlobalAddr(lv->loc))
+                emit(RGETU, d, 0, lv->loc - GLOBAL_BASE);
+            else
+                emit(RGETU, d, lv->depth, lv->loc);
+            return d;
+        }
+        void writeVar(LocalVar* lv, int src) {
+            int reg = registerOf(lv);
+            if (reg >= 0) {
+                if (reg != src)
+                    emit(RMOV, reg, src);
+            } else if (isGlobalAddr(lv->loc)) {
+                emit(RSETU, src, 0, lv->loc - GLOBAL_BASE);
+            } else {
+                emit(RSETU, src, lv->depth, lv->loc);
+            }
+        }
+        LocalVar* lookup(ASTNode* node) {
+            LocalVar* lv = st.getVar(node->data.strval);
+            if (lv == nullptr) {
+                cout<<"Error: attempt to reference undelcared variable: "<<node->data.strval<<endl;
+                emit(RHALT);
+            }
+            return lv;
+        }
+        //a variable's register read as the left operand has to be copied
+        //first if the right one could assign to it
+        int keep(int reg, ASTNode* rhs) {
+            if (reg < curProc().numSlots && hasEffects(rhs)) {
+                int t = temp();
+                emit(RMOV, t, reg);
+                return t;
+            }
+            return reg;
+        }
+        //only globals can be arrays here, anything else indexed
+        //is left to the P-machine
+        int arrayBase(LocalVar* lv) {
+            if (!isGlobalAddr(lv->loc) && failure.empty())
+                failure = "indexed locals";
+            return lv->loc - GLOBAL_BASE;
+        }
+        RegOp binOp(int symbol) {
+            switch (symbol) {
+                case TK_ADD: return RADD;
+                case TK_SUB: return RSUB;
+                case TK_MUL: return RMUL;
+                case TK_DIV: return RDIV;
+                case TK_LT:  return RLT;
+                case TK_LTE: return RLTE;
+                case TK_GT:  return RGT;
+                case TK_GTE: return RGTE;
+                case TK_EQU: return REQU;
+                case TK_NEQ: return RNEQ;
+                default: break;
+            }
+            return RHALT;
+        }
+        RegOp withBranch(RegOp op) {
+            switch (op) {
+                case REQU: return REQUJ;
+                case RNEQ: return RNEQJ;
+                case RLTE: return RLTEJ;
+                case RGTE: return RGTEJ;
+                case RLT:  return RLTJ;
+                case RGT:  return RGTJ;
+                default: break;
+            }
+            return RHALT;
+        }
+        int genBinary(ASTNode* node, int dst) {
+            int mark = cur().top;
+            int lhs = keep(expr(node->child[0], -1), node->child[1]);
+            int rhs = expr(node->child[1], -1);
+            cur().top = mark;
+            int d = into(dst);
+            emit(binOp(node->data.symbol), d, lhs, rhs);
+            return d;
+        }
+        int genUnary(ASTNode* node, int dst) {
+            int mark = cur().top;
+            ASTNode* arg = node->child[0];
+            switch (node->data.symbol) {
+                case TK_SUB:
+                case TK_NOT: {
+                    int v = expr(arg, -1);
+                    cur().top = mark;
+                    int d = into(dst);
+                    emit(node->data.symbol == TK_SUB ? RNEG:RNOT, d, v);
+                    return d;
+                }
+                case TK_POST_INC:
+                case TK_POST_DEC: {
+                    RegOp op = node->data.symbol == TK_POST_INC ? RADD:RSUB;
+                    int one = constantReg(makeInt(1));
+                    LocalVar* lv = lookup(arg);
+                    if (lv == nullptr)
+                        return into(dst);
+                    if (hasSubscript(arg)) {
+                        int idx = expr(arg->child[0]->child[0], -1);
+                        int t = temp();
+                        emit(RGETX, t, arrayBase(lv), idx);
+                        emit(op, t, t, one);
+                        emit(RSETX, t, arrayBase(lv), idx);
+                        return t;
+                    }
+                    int reg = registerOf(lv);
+                    if (reg >= 0) {
+                        emit(op, reg, reg, one);
+                        return reg;
+                    }
+                    int t = readVar(lv, -1);
+                    emit(op, t, t, one);
+                    writeVar(lv, t);
+                    return t;
+                }
+                default:
+                    break;
+            }
+            return into(dst);
+        }
+        int genAssignment(ASTNode* target, ASTNode* value, int dst) {
+            LocalVar* lv = lookup(target);
+            if (lv == nullptr)
+                return into(dst);
+            if (hasSubscript(target)) {
+                int idx = keep(expr(target->child[0]->child[0], -1), value);
+                int v = expr(value, dst);
+                emit(RSETX, v, arrayBase(lv), idx);
+                return v;
+            }
+            int reg = registerOf(lv);
+            if (reg >= 0)
+                return expr(value, reg);
+            int v = expr(value, dst);
+            writeVar(lv, v);
+            return v;
+        }
+        int genCall(ASTNode* node, int dst) {
+            int mark = cur().top;
+            int nargs = 0;
+            for (ASTNode* t = node->child[1]; t != nullptr; t = t->next)
+                nargs++;
+            int base = cur().top;
+            for (int i = 0; i < nargs; i++)
+                temp();
+            int i = 0;
+            for (ASTNode* t = node->child[1]; t != nullptr; t = t->next)
+                expr(t, base + i++);
+            cur().top = mark;
+            int d = into(dst);
+            int proc = -1;
+            auto it = procIndex.find(node->data.strval);
+            if (it != procIndex.end())
+                proc = it->second;
+            int at = emit(RCAL, d, proc, base, nargs);
+            if (proc < 0)
+                pendingCalls[node->data.strval].push_back(at);
+            return d;
+        }
+        int value(ASTNode* node, int dst) {
+            if (node == nullptr || node->nk != EXPR_NODE)
+                return into(dst);
+            switch (node->type.expr) {
+                case CONST_EXPR:
+                case STR_EXPR: {
+                    Value val = isExpr(node, CONST_EXPR) ? node->value:makeString(node->data.strval);
+                    int reg = constantReg(val);
+                    if (dst >= 0)
+                        emit(RMOV, dst, reg);
+                    return dst >= 0 ? dst:reg;
+                }
+                case ID_EXPR: {
+                    LocalVar* lv = lookup(node);
+                    if (lv == nullptr)
+                        return into(dst);
+                    if (hasSubscript(node)) {
+                        int mark = cur().top;
+                        int idx = expr(node->child[0]->child[0], -1);
+                        cur().top = mark;
+                        int d = into(dst);
+                        emit(RGETX, d, arrayBase(lv), idx);
+                        return d;
+                    }
+                    return readVar(lv, dst);
+                }
+                case BINOP_EXPR:
+                case RELOP_EXPR:
+                    return genBinary(node, dst);
+                case UNOP_EXPR:
+                    return genUnary(node, dst);
+                case ASSIGN_EXPR:
+                    return genAssignment(node->child[0], node->child[1], dst);
+                case FUNC_EXPR:
+                    return genCall(node, dst);
+                case REG_EXPR: {
+                    int mark = cur().top;
+                    int text = keep(expr(node->child[0], -1), node->child[1]);
+                    int pattern = expr(node->child[1], -1);
+                    cur().top = mark;
+                    int d = into(dst);
+                    emit(RMATCH, d, text, pattern);
+                    return d;
+                }
+                default:
+                    break;
+            }
+            return into(dst);
+        }
+        //Returns the register holding the value of node, which is dst
+        //when one is given. Without one that may be a variable's or
+        //constant's own register, which must not be written to.
+        int expr(ASTNode* node, int dst) {
+            int reg = value(node, dst);
+            if (dst >= 0 && reg != dst) {
+                emit(RMOV, dst, reg);
+                return dst;
+            }
+            return reg;
+        }
+        //returns the jump to patch with the address to go to when cond is false
+        int jumpUnless(ASTNode* cond) {
+            int mark = cur().top;
+            int at;
+            if (isExpr(cond, RELOP_EXPR) && withBranch(binOp(cond->data.symbol)) != RHALT) {
+                int lhs = keep(expr(cond->child[0], -1), cond->child[1]);
+                int rhs = expr(cond->child[1], -1);
+                at = emit(withBranch(binOp(cond->data.symbol)), -1, lhs, rhs);
+            } else {
+                at = emit(RJPC, -1, expr(cond, -1));
+            }
+            cur().top = mark;
+            return at;
+        }
+        void result(int reg) {
+            if (cur().depth > 0)
+                emit(RRES, reg);
+        }
+        //a call statement is a procedure's result only when it is the last
+        //statement of the body, or of either branch of an if which is
+        void markResultCalls(ASTNode* list) {
+            if (list == nullptr)
+                return;
+            while (list->next != nullptr)
+                list = list->next;
+            if (isStmt(list, EXPR_STMT) && isExpr(list->child[0], FUNC_EXPR)) {
+                resultCalls.insert(list);
+            } else if (isStmt(list, IF_STMT)) {
+                markResultCalls(list->child[1]);
+                markResultCalls(list->child[2]);
+            }
+        }
+        void genFunctionDefinition(ASTNode* node) {
+            markResultCalls(node->child[1]);
+            int skip = emit(RJMP);
+            st.openScope(node->data.strval);
+            procIndex[node->data.strval] = program->procedures.size();
+            auto pending = pendingCalls.find(node->data.strval);
+            if (pending != pendingCalls.end()) {
+                for (int at : pending->second)
+                    code()[at].b = program->procedures.size();
+                pendingCalls.erase(pending);
+            }
+            openProcedure(node->data.strval, node->child[1], st.scopeSize(node->data.strval));
+            genStmts(node->child[1]);
+            emit(RRET);
+            contexts.pop_back();
+            st.closeScope();
+            code()[skip].a = code().size();
+        }
+        void genStmts(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                cur().top = cur().tempBase;
+                switch (node->type.stmt) {
+                    case PROGRAM_STMT:
+                        genStmts(node->child[0]);
+                        break;
+                    case LET_STMT: {
+                        if (hasSubscript(node))
+                            break;
+                        result(genAssignment(node, node->child[0], -1));
+                    } break;
+                    case PRINT_STMT:
+                        emit(RPRINT, expr(node->child[0], -1));
+                        break;
+                    case EXPR_STMT: {
+                        int v = expr(node->child[0], -1);
+                        if (isExpr(node->child[0], FUNC_EXPR) && resultCalls.count(node) == 0)
+                            break;
+                        if (!isUpdate(node->child[0]))
+                            result(v);
+                    } break;
+                    case RETURN_STMT:
+                        result(expr(node->child[0], -1));
+                        break;
+                    case IF_STMT: {
+                        int skipThen = jumpUnless(node->child[0]);
+                        genStmts(node->child[1]);
+                        if (node->child[2] != nullptr) {
+                            int skipElse = emit(RJMP);
+                            code()[skipThen].a = code().size();
+                            genStmts(node->child[2]);
+                            code()[skipElse].a = code().size();
+                        } else {
+                            code()[skipThen].a = code().size();
+                        }
+                    } break;
+                    case WHILE_STMT: {
+                        int test = code().size();
+                        int exit = jumpUnless(node->child[0]);
+                        genStmts(node->child[1]);
+                        emit(RJMP, test);
+                        code()[exit].a = code().size();
+                    } break;
+                    case FUNC_DEF_STMT:
+                        genFunctionDefinition(node);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        //same message as PCodeGenerator, the calls halt the program
+        void resolveUndefinedCalls() {
+            for (auto& pending : pendingCalls) {
+                cout<<"Error: call to undefined procedure: "<<pending.first<<endl;
+                for (int at : pending.second)
+                    code()[at] = RegInstruction(RHALT);
+            }
+            pendingCalls.clear();
+        }
+    public:
+        RegisterCodeGenerator(bool trace = false) {
+            should_trace = trace;
+            program = nullptr;
+            globalsSize = 0;
+        }
+        void setTrace(bool trace) {
+            should_trace = trace;
+        }
+        //Returns what the register machine can't run, or the empty
+        //string once program holds the generated code.
+        string generate(ASTNode* node, RegProgram& prog) {
+            string what = findUnsupported(node, false);
+            if (!what.empty())
+                return what;
+            program = &prog;
+            program->code.clear();
+            program->procedures.clear();
+            contexts.clear();
+            procIndex.clear();
+            pendingCalls.clear();
+            resultCalls.clear();
+            st = ScopingSymbolTable();
+            globalsSize = 0;
+            failure.clear();
+            buildST(node);
+            if (should_trace)
+                st.print();
+            openProcedure("", isStmt(node, PROGRAM_STMT) ? node->child[0]:node, globalsSize);
+            genStmts(node);
+            emit(RHALT);
+            contexts.pop_back();
+            if (!failure.empty())
+                return failure;
+            resolveUndefinedCalls();
+            return "";
+        }
+};
+
+#endif
\ No newline at end of file
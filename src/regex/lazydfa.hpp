@@ -0,0 +1,140 @@
+#ifndef lazydfa_hpp
+#define lazydfa_hpp
+#include <iostream>
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <vector>
+#include "nfa.hpp"
+using namespace std;
+
+//Lazy subset construction: a DFA state is the e-closure of a set of
+//NFA states, and the transition out of it on a byte is only computed
+//the first time that byte is seen in that state. Once built, matching
+//is one table lookup per byte of input.
+//
+//Every DFA state costs a full row of 256 transitions, so the number of
+//states is bounded by a memory budget. When it runs out, the rest of
+//the input is matched by simulating the NFA from the current state set.
+const int DFA_UNKNOWN = -1;
+const int DFA_OVERFLOW = -2;
+
+class LazyDFA {
+    private:
+        struct DFAState {
+            vector<int> nfaStates;
+            bool accepting;
+        };
+        NFA nfa;
+        int nfaStart;
+        int nfaAccept;
+        vector<DFAState> dstates;
+        vector<int> table;
+        map<vector<int>, int> index;
+        size_t budget;
+        size_t used;
+        bool overflowed;
+        vector<int> marks;
+        int generation;
+        //e-closure of states, returned sorted so it can be used as a key
+        vector<int> closure(vector<int> states) {
+            generation++;
+            vector<int> work = states;
+            for (int s : states)
+                marks[s] = generation;
+            while (!work.empty()) {
+                int s = work.back();
+                work.pop_back();
+                for (State t : nfa.epsilonsFrom(s)) {
+                    if (marks[t] != generation) {
+                        marks[t] = generation;
+                        states.push_back(t);
+                        work.push_back(t);
+                    }
+                }
+            }
+            sort(states.begin(), states.end());
+            return states;
+        }
+        vector<int> step(vector<int>& states, unsigned char c) {
+            vector<int> next;
+            generation++;
+            for (int s : states) {
+                for (Transition& t : nfa.movesFrom(s)) {
+                    if (t.accepts[c] && marks[t.to] != generation) {
+                        marks[t.to] = generation;
+                        next.push_back(t.to);
+                    }
+                }
+            }
+            return closure(next);
+        }
+        bool accepts(vector<int>& states) {
+            return binary_search(states.begin(), states.end(), nfaAccept);
+        }
+        size_t stateCost(vector<int>& states) {
+            return 256*sizeof(int) + states.size()*sizeof(int) + sizeof(DFAState);
+        }
+        int addState(vector<int> states) {
+            auto it = index.find(states);
+            if (it != index.end())
+                return it->second;
+            if (used + stateCost(states) > budget) {
+                overflowed = true;
+                return DFA_OVERFLOW;
+            }
+            used += stateCost(states);
+            int id = dstates.size();
+            dstates.push_back({states, accepts(states)});
+            table.resize(table.size() + 256, DFA_UNKNOWN);
+            index[states] = id;
+            return id;
+        }
+        bool simulate(vector<int> states, string& text, int pos) {
+            for (int i = pos; i < text.length() && !states.empty(); i++)
+                states = step(states, text[i]);
+            return accepts(states);
+        }
+    public:
+        LazyDFA(NFA& fa, size_t memoryBudget = 1 << 20) : nfa(fa) {
+            budget = memoryBudget;
+            used = 0;
+            overflowed = false;
+            nfaStart = nfa.getStart();
+            nfaAccept = nfa.getAccept();
+            marks = vector<int>(nfa.size(), 0);
+            generation = 0;
+            addState(closure(vector<int>(1, nfaStart)));
+        }
+        bool match(string text) {
+            if (dstates.empty())
+                return simulate(closure(vector<int>(1, nfaStart)), text, 0);
+            int d = 0;
+            for (int i = 0; i < text.length(); i++) {
+                unsigned char c = text[i];
+                int next = table[d*256 + c];
+                if (next == DFA_UNKNOWN) {
+                    vector<int> states = step(dstates[d].nfaStates, c);
+                    next = addState(states);
+                    if (next == DFA_OVERFLOW)
+                        return simulate(states, text, i+1);
+                    table[d*256 + c] = next;
+                }
+                d = next;
+                if (dstates[d].nfaStates.empty())
+                    return false;
+            }
+            return dstates[d].accepting;
+        }
+        int stateCount() {
+            return dstates.size();
+        }
+        size_t memoryUsed() {
+            return used;
+        }
+        bool hasOverflowed() {
+            return overflowed;
+        }
+};
+
+#endif
\ No newline at end of file
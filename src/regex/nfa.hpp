@@ -1,172 +1,114 @@
 #ifndef nfa_hpp
 #define nfa_hpp
 #include <iostream>
-#include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <bitset>
 #include <vector>
 #include "stack.hpp"
 #include "re_tokenizer.hpp"
 using namespace std;
 
-class Edge {
-    public:
-        virtual RegExToken getLabel() = 0;
-        virtual bool matches(char c) = 0;
-        virtual bool positionIs(int index) = 0;
-        virtual bool isEpsilon() = 0;
-        virtual ~Edge() { }
-};
+typedef int State;
+typedef bitset<256> CharClass;
 
-class CharEdge : public Edge {
-    private:
-        RegExToken label;
-        bool checkInRange(char c) {
-            char lo, hi;
-            bool is_good = false;
-            for (int i = 1; i < label.charachters.size()-1; i++) {
-                if (i+1 < label.charachters.size() && label.charachters[i] == '-') {
-                    lo = label.charachters[i-1];
-                    hi = label.charachters[i+1];
-                    if (hi < lo) {
-                        char tmp = hi;
-                        hi = lo;
-                        lo = tmp;
-                    }
-                    if (c >= lo && c <= hi) {
-                        is_good = true;
-                        break;
-                    }
-                }
+bool checkInRange(RegExToken& label, char c) {
+    char lo, hi;
+    bool is_good = false;
+    for (int i = 1; i < label.charachters.size()-1; i++) {
+        if (i+1 < label.charachters.size() && label.charachters[i] == '-') {
+            lo = label.charachters[i-1];
+            hi = label.charachters[i+1];
+            if (hi < lo) {
+                char tmp = hi;
+                hi = lo;
+                lo = tmp;
             }
-            return is_good;
-        }
-    public:
-        CharEdge(RegExToken c) {
-            label = c;
-        }
-        ~CharEdge() {
-
-        }
-        bool isEpsilon() {
-            return false;
-        }
-        bool positionIs(int i) {
-            return true;
-        }
-        bool matches(char c) {
-            if (label.symbol == RE_SPECIFIEDSET) {
-                for (char m : label.charachters) {
-                    if (c == m)
-                        return true;
-                }
-                return false;
-            } else if (label.symbol == RE_SPECIFIEDRANGE) {
-                return checkInRange(c);
+            if (c >= lo && c <= hi) {
+                is_good = true;
+                break;
             }
-            return label.charachters[0] == c;
         }
-        RegExToken getLabel() {
-            return label;
-        }
-};
+    }
+    return is_good;
+}
 
-class EpsilonEdge : public Edge {
-    public:
-        EpsilonEdge() { }
-        ~EpsilonEdge() { }
-        bool matches(char c) {
-            return true;
-        }
-        bool positionIs(int i) {
-            return true;
-        }
-        bool isEpsilon() {
-            return true;
-        }
-        RegExToken getLabel() {
-            return RegExToken(RE_NONE, "&");
-        }
-};
+bool labelMatches(RegExToken& label, char c) {
+    if (label.symbol == RE_SPECIFIEDSET) {
+        for (char m : label.charachters) {
+            if (c == m)
+                return true;
+        }
+        return false;
+    } else if (label.symbol == RE_SPECIFIEDRANGE) {
+        return checkInRange(label, c);
+    }
+    return label.charachters[0] == c;
+}
 
+//The bytes a character edge accepts. An edge that accepts '.' is the
+//wildcard and accepts every byte.
+CharClass makeCharClass(RegExToken label) {
+    CharClass accepts;
+    for (int c = 0; c < 256; c++)
+        accepts[c] = labelMatches(label, (char)c);
+    if (accepts['.'])
+        accepts.set();
+    return accepts;
+}
 
-typedef int State;
+string charClassStr(CharClass& accepts) {
+    if (accepts.all())
+        return ".";
+    string str;
+    for (int c = 0; c < 256; c++)
+        if (accepts[c])
+            str.push_back((char)c);
+    return str;
+}
 
 struct Transition {
     State from;
     State to;
-    Edge* edge;
-    Transition(State s, State t, Edge* e) {
-        from = s; to = t; edge = e;
-    }
-    Transition(const Transition& t) {
-        from = t.from;
-        to = t.to;
-        if (t.edge->isEpsilon()) {
-            edge = new EpsilonEdge();
-        } else {
-            edge = new CharEdge(t.edge->getLabel());
-        }
-    }
-    ~Transition() {
-        delete edge;
-    }
-    Transition& operator=(const Transition& t) {
-        if (this != &t) {
-            from = t.from;
-            to = t.to;
-            if (t.edge->isEpsilon()) {
-                edge = new EpsilonEdge();
-            } else {
-                edge = new CharEdge(t.edge->getLabel());
-            }
-        }
-        return *this;
+    CharClass accepts;
+    Transition(State s = 0, State t = 0, CharClass c = CharClass()) {
+        from = s; to = t; accepts = c;
     }
 };
 
-bool operator==(const Transition& s, const Transition& t) {
-    return s.from == t.from && s.to == t.to && s.edge == t.edge;
-}
-
-bool operator!=(const Transition& s, const Transition& t) {
-    return !(s == t);
-}
-
-namespace std {
-    template <> struct hash<Transition> {
-        std::size_t operator()(const Transition& t) const noexcept {
-            string tmp = to_string(t.from);
-            tmp += t.edge->getLabel().charachters;
-            tmp += to_string(t.to);
-            return std::hash<string>()(tmp);
-        }
-    };
-}
+template <class T>
+struct Range {
+    T* first;
+    T* last;
+    T* begin() { return first; }
+    T* end() { return last; }
+};
 
+//States are numbered densely from 0. Character edges and epsilon edges
+//are kept in two flat lists while the NFA is being built, build() then
+//sorts both by source state so that the edges out of a state are a
+//contiguous run found through an index.
 class NFA {
     private:
         State start;
         State accept;
-        unordered_map<State, unordered_set<Transition>> states;
+        int numStates;
+        vector<Transition> transitions;
+        vector<pair<State, State>> epsilonEdges;
+        vector<int> firstMove;
+        vector<int> firstEpsilon;
+        vector<State> epsilonTargets;
+        void touch(State s) {
+            if (s >= numStates)
+                numStates = s+1;
+        }
     public:
         NFA() {
             start = 0;
             accept = 0;
-        }
-        NFA(const NFA& nfa) {
-            start = nfa.start;
-            accept = nfa.accept;
-            for (auto m : nfa.states) {
-                makeState(m.first);
-                for (auto t : m.second) {
-                    addTransition(t);
-                }
-            }
+            numStates = 0;
         }
         void makeState(State name) {
-            if (states.find(name) == states.end()) {
-                states.insert(make_pair(name, unordered_set<Transition>()));
-            }
+            touch(name);
         }
         void setStart(State ss) {
             start = ss;
@@ -181,29 +123,52 @@ class NFA {
             return accept;
         }
         void addTransition(Transition t) {
-            states[t.from].insert(t);
+            touch(t.from);
+            touch(t.to);
+            transitions.push_back(t);
+        }
+        void addEpsilon(State from, State to) {
+            touch(from);
+            touch(to);
+            epsilonEdges.push_back(make_pair(from, to));
+        }
+        //copies every state and edge of other into this NFA
+        void merge(NFA& other) {
+            touch(other.numStates-1);
+            transitions.insert(transitions.end(), other.transitions.begin(), other.transitions.end());
+            epsilonEdges.insert(epsilonEdges.end(), other.epsilonEdges.begin(), other.epsilonEdges.end());
+        }
+        void build() {
+            stable_sort(transitions.begin(), transitions.end(), [](const Transition& a, const Transition& b) {
+                return a.from < b.from;
+            });
+            stable_sort(epsilonEdges.begin(), epsilonEdges.end(), [](const pair<State,State>& a, const pair<State,State>& b) {
+                return a.first < b.first;
+            });
+            firstMove = vector<int>(numStates+1, 0);
+            firstEpsilon = vector<int>(numStates+1, 0);
+            epsilonTargets.clear();
+            for (Transition& t : transitions)
+                firstMove[t.from+1]++;
+            for (auto& e : epsilonEdges) {
+                firstEpsilon[e.first+1]++;
+                epsilonTargets.push_back(e.second);
+            }
+            for (int i = 0; i < numStates; i++) {
+                firstMove[i+1] += firstMove[i];
+                firstEpsilon[i+1] += firstEpsilon[i];
+            }
         }
         int size() {
-            return states.size();
-        }
-        unordered_map<State, unordered_set<Transition>>& getStates() {
-            return states;
-        }
-        unordered_set<Transition>& getTransitions(State state) {
-            return states[state];
-        }
-        NFA& operator=(const NFA& nfa) {
-            if (this != &nfa) {
-                start = nfa.start;
-                accept = nfa.accept;
-                for (auto m : nfa.states) {
-                    makeState(m.first);
-                    for (auto t : m.second) {
-                        addTransition(t);
-                    }
-                }
-            }
-            return *this;
+            return numStates;
+        }
+        Range<Transition> movesFrom(State s) {
+            Transition* base = transitions.data();
+            return { base + firstMove[s], base + firstMove[s+1] };
+        }
+        Range<State> epsilonsFrom(State s) {
+            State* base = epsilonTargets.data();
+            return { base + firstEpsilon[s], base + firstEpsilon[s+1] };
         }
 };
 
@@ -2,75 +2,79 @@
 #define patternmatcher_hpp
 #include <iostream>
 #include "nfa.hpp"
+#include "sparseset.hpp"
 using namespace std;
 
-void printEdge(Transition& t) {
-    if (t.edge->isEpsilon()) {
-        cout<<'\t'<<t.from<<" - ["<<t.edge->getLabel().charachters<<"] ->"<<t.to<<endl;
+void printEdge(State from, State to, string label, bool epsilon) {
+    if (epsilon) {
+        cout<<'\t'<<from<<" - ["<<label<<"] ->"<<to<<endl;
     } else {
-        cout<<'\t'<<t.from<<" - ("<<t.edge->getLabel().charachters<<") ->"<<t.to<<endl;
+        cout<<'\t'<<from<<" - ("<<label<<") ->"<<to<<endl;
     }
 }
 
+//Pike VM style simulation: the current and next state lists are sparse
+//sets sized to the NFA, so stepping over a character allocates nothing.
 class RegExPatternMatcher {
     private:
-        NFA nfa;
-        // Gathers a list of states reachable from those in 
-        // currStates which have transition that consume ch
-        unordered_set<State> move(unordered_set<State> currStates, char ch) {
-            unordered_set<State> nextStates;
-            if (loud) cout<<ch<<": "<<endl;
-            for (State s : currStates) {
-                for (Transition t : nfa.getTransitions(s)) {
-                    if (t.edge->matches(ch) || t.edge->matches('.')) {
-                        if (t.edge->isEpsilon() == false && nextStates.find(t.to) == nextStates.end()) {
-                            if (loud) printEdge(t);
-                            nextStates.insert(t.to);
-                        } 
+        NFA* nfa;
+        SparseSet curr;
+        SparseSet next;
+        vector<State> work;
+        //Adds s to states along with every state reachable
+        //from it by using _only_ epsilon transitions.
+        void addState(SparseSet& states, State s) {
+            if (states.contains(s))
+                return;
+            states.insert(s);
+            work.clear();
+            work.push_back(s);
+            while (!work.empty()) {
+                State u = work.back();
+                work.pop_back();
+                for (State t : nfa->epsilonsFrom(u)) {
+                    if (!states.contains(t)) {
+                        if (loud) printEdge(u, t, "&", true);
+                        states.insert(t);
+                        work.push_back(t);
                     }
                 }
             }
-            return nextStates;
         }
-        //An interesting adaptation of Depth First Search.
-        //Gathers a list of states reachable from those in 
-        //currStates by using _only_ epsilon transitions.
-        unordered_set<State> e_closure(unordered_set<State> currStates) {
-            unordered_set<State> nextStates = currStates;
-            IndexedStack<State> sf;
-            for (State s : currStates)
-                sf.push(s);
-            while (!sf.empty()) {
-                State s = sf.pop();
-                for (Transition t : nfa.getTransitions(s)) {
-                    if (t.edge->isEpsilon()) {
-                        if (nextStates.find(t.to) == nextStates.end()) {
-                            if (loud) printEdge(t);
-                            nextStates.insert(t.to);
-                            sf.push(t.to);
-                        }
+        // Gathers the states reachable from those in curr
+        // by a transition that consumes ch
+        void move(char ch) {
+            unsigned char c = ch;
+            if (loud) cout<<ch<<": "<<endl;
+            next.clear();
+            for (int i = 0; i < curr.size(); i++) {
+                for (Transition& t : nfa->movesFrom(curr[i])) {
+                    if (t.accepts[c] && !next.contains(t.to)) {
+                        if (loud) printEdge(t.from, t.to, charClassStr(t.accepts), false);
+                        addState(next, t.to);
                     }
                 }
             }
-            return nextStates;
+            curr.swap(next);
         }
         bool loud;
     public:
-        RegExPatternMatcher(NFA& fa, bool trace = false) : nfa(fa), loud(trace) {
-
+        RegExPatternMatcher(NFA& fa, bool trace = false) : loud(trace) {
+            setNFA(fa);
         }
         void setNFA(NFA& fa) {
-            nfa = fa;
+            nfa = &fa;
+            curr.resize(nfa->size());
+            next.resize(nfa->size());
+            work.reserve(nfa->size());
         }
         bool match(string text) {
-            unordered_set<State> curr, next;
-            next.insert(nfa.getStart());
-            curr = e_closure(next);
-            for (int i = 0; i < text.length(); i++) {
-                next = move(curr, text[i]);
-                curr = e_closure(next);
+            curr.clear();
+            addState(curr, nfa->getStart());
+            for (int i = 0; i < text.length() && curr.size() > 0; i++) {
+                move(text[i]);
             }
-            return curr.find(nfa.getAccept()) != curr.end();
+            return curr.contains(nfa->getAccept());
         }
 };
 
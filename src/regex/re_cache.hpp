@@ -0,0 +1,77 @@
+#ifndef re_cache_hpp
+#define re_cache_hpp
+#include <iostream>
+#include <list>
+#include <unordered_map>
+#include "re_compiler.hpp"
+#include "nfa.hpp"
+#include "lazydfa.hpp"
+using namespace std;
+
+//A pattern's NFA, used when tracing, and the DFA built from it lazily
+//as it is matched against text.
+struct CompiledRegEx {
+    NFA nfa;
+    LazyDFA dfa;
+    CompiledRegEx(NFA fa) : nfa(fa), dfa(nfa) { }
+};
+
+CompiledRegEx compileRegEx(string pattern) {
+    NFACompiler reCompiler;
+    return CompiledRegEx(reCompiler.compile(pattern));
+}
+
+//Compiled patterns keyed by their source text. The most recently used
+//pattern is kept at the front of the list, when the cache grows past
+//its capacity the pattern at the back is dropped.
+class RegExCache {
+    private:
+        typedef pair<string, CompiledRegEx> CacheEntry;
+        list<CacheEntry> entries;
+        unordered_map<string, list<CacheEntry>::iterator> index;
+        int capacity;
+        int hits;
+        int misses;
+        void evict() {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    public:
+        RegExCache(int maxPatterns = 64) {
+            capacity = maxPatterns;
+            hits = 0;
+            misses = 0;
+        }
+        CompiledRegEx& get(string pattern) {
+            auto it = index.find(pattern);
+            if (it != index.end()) {
+                hits++;
+                entries.splice(entries.begin(), entries, it->second);
+                return it->second->second;
+            }
+            misses++;
+            entries.emplace_front(pattern, compileRegEx(pattern));
+            index[pattern] = entries.begin();
+            if (entries.size() > capacity)
+                evict();
+            return entries.front().second;
+        }
+        void clear() {
+            entries.clear();
+            index.clear();
+        }
+        int size() {
+            return entries.size();
+        }
+        int hitCount() {
+            return hits;
+        }
+        int missCount() {
+            return misses;
+        }
+        void printStats() {
+            cout<<"Regex cache: "<<hits<<" hits, "<<misses<<" misses, "<<entries.size()<<"/"<<capacity<<" patterns."<<endl;
+        }
+};
+
+#endif
\ No newline at end of file
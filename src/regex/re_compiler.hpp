@@ -20,29 +20,23 @@ class NFACompiler {
             nnfa.makeState(nend);
             nnfa.setAccept(nend);
         }
-        void copyTransitions(NFA& nnfa, NFA onfa) {
-            for (auto state : onfa.getStates()) {
-                nnfa.makeState(state.first);
-                for (auto trans : onfa.getTransitions(state.first)) {
-                    nnfa.addTransition(trans);
-                }
-            }
+        void copyTransitions(NFA& nnfa, NFA& onfa) {
+            nnfa.merge(onfa);
         }
-        NFA singleTransitionNFA(Edge* edge) {
+        NFA emptyExpr() {
             NFA nfa;
             initNextNFA(nfa);
-            nfa.addTransition(Transition(nfa.getStart(), nfa.getAccept(), edge)); 
+            nfa.addEpsilon(nfa.getStart(), nfa.getAccept());
             return nfa;
         }
-
-        NFA emptyExpr() {
-            return singleTransitionNFA(new EpsilonEdge());
-        }
         /*
             A -> N(A)
         */
         NFA atomicNFA(RegExToken c) {
-            return singleTransitionNFA(new CharEdge(c));
+            NFA nfa;
+            initNextNFA(nfa);
+            nfa.addTransition(Transition(nfa.getStart(), nfa.getAccept(), makeCharClass(c)));
+            return nfa;
         }
 
         /*
@@ -54,7 +48,7 @@ class NFACompiler {
             copyTransitions(nnfa, second);
             nnfa.setStart(first.getStart());
             nnfa.setAccept(second.getAccept());
-            nnfa.addTransition(Transition(first.getAccept(), second.getStart(), new EpsilonEdge()));
+            nnfa.addEpsilon(first.getAccept(), second.getStart());
             return nnfa;
         }
         /*
@@ -68,11 +62,11 @@ class NFACompiler {
             NFA nnfa;
             initNextNFA(nnfa);
             copyTransitions(nnfa, torepeat);
-            nnfa.addTransition(Transition(torepeat.getAccept(), nnfa.getStart(), new EpsilonEdge()));
-            nnfa.addTransition(Transition(nnfa.getStart(), torepeat.getStart(), new EpsilonEdge()));
-            nnfa.addTransition(Transition(torepeat.getAccept(), nnfa.getAccept(), new EpsilonEdge()));
+            nnfa.addEpsilon(torepeat.getAccept(), nnfa.getStart());
+            nnfa.addEpsilon(nnfa.getStart(), torepeat.getStart());
+            nnfa.addEpsilon(torepeat.getAccept(), nnfa.getAccept());
             if (!mustMatch)
-                nnfa.addTransition(Transition(nnfa.getStart(), nnfa.getAccept(), new EpsilonEdge()));
+                nnfa.addEpsilon(nnfa.getStart(), nnfa.getAccept());
             return nnfa;
         }
         /* 
@@ -91,11 +85,11 @@ class NFACompiler {
             copyTransitions(nnfa, first);
             copyTransitions(nnfa, second);
             //Add new E-transitions from new start state to first and second NFAs
-            nnfa.addTransition(Transition(nnfa.getStart(), first.getStart(), new EpsilonEdge()));
-            nnfa.addTransition(Transition(nnfa.getStart(), second.getStart(), new EpsilonEdge()));
+            nnfa.addEpsilon(nnfa.getStart(), first.getStart());
+            nnfa.addEpsilon(nnfa.getStart(), second.getStart());
             //Add new E-transitions from first and second accept state to new accept state.
-            nnfa.addTransition(Transition(first.getAccept(), nnfa.getAccept(), new EpsilonEdge()));
-            nnfa.addTransition(Transition(second.getAccept(), nnfa.getAccept(), new EpsilonEdge()));
+            nnfa.addEpsilon(first.getAccept(), nnfa.getAccept());
+            nnfa.addEpsilon(second.getAccept(), nnfa.getAccept());
             return nnfa;
         }
         NFA zeroOrOnce(NFA onfa) {
@@ -103,10 +97,10 @@ class NFACompiler {
             initNextNFA(nnfa);
             copyTransitions(nnfa, onfa);
             //wire in match choice
-            nnfa.addTransition(Transition(nnfa.getStart(), onfa.getStart(), new EpsilonEdge()));
-            nnfa.addTransition(Transition(onfa.getAccept(), nnfa.getAccept(), new EpsilonEdge()));
+            nnfa.addEpsilon(nnfa.getStart(), onfa.getStart());
+            nnfa.addEpsilon(onfa.getAccept(), nnfa.getAccept());
             //wire in epsilon choice.
-            nnfa.addTransition(Transition(nnfa.getStart(), nnfa.getAccept(), new EpsilonEdge()));
+            nnfa.addEpsilon(nnfa.getStart(), nnfa.getAccept());
             return nnfa;
         }
 
@@ -122,8 +116,8 @@ class NFACompiler {
                 NFA tnfa;
                 initNextNFA(tnfa);
                 copyTransitions(tnfa, a);
-                tnfa.addTransition(Transition(tnfa.getStart(), a.getStart(), new EpsilonEdge()));
-                tnfa.addTransition(Transition(a.getAccept(), tnfa.getAccept(), new EpsilonEdge()));
+                tnfa.addEpsilon(tnfa.getStart(), a.getStart());
+                tnfa.addEpsilon(a.getAccept(), tnfa.getAccept());
                 sf.push(tnfa);
             }
             NFA fnfa;
@@ -132,10 +126,10 @@ class NFACompiler {
             while (!sf.empty()) {
                 NFA tmp = sf.pop();
                 copyTransitions(fnfa, tmp);
-                fnfa.addTransition(Transition(prev, tmp.getStart(), new EpsilonEdge()));
+                fnfa.addEpsilon(prev, tmp.getStart());
                 prev = tmp.getAccept();
             }
-            fnfa.addTransition(Transition(prev, fnfa.getAccept(), new EpsilonEdge()));
+            fnfa.addEpsilon(prev, fnfa.getAccept());
             return fnfa;
         }
         NFA buildOperatorNFA(RegularExpression* ast) {
@@ -184,7 +178,7 @@ class NFACompiler {
         }
         bool loud;
     public:
-        NFACompiler(bool trace = false) {
+        NFACompiler(bool trace = false) : nfaStack(64) {
             l = 0;
             loud = trace;
         }
@@ -195,7 +189,9 @@ class NFACompiler {
             if (loud)
                 traverse(ast, 1);
             gen_nfa(ast);
-            return nfaStack.pop();
+            NFA nfa = nfaStack.pop();
+            nfa.build();
+            return nfa;
         }
 };
 
@@ -0,0 +1,45 @@
+#ifndef sparseset_hpp
+#define sparseset_hpp
+#include <vector>
+using namespace std;
+
+//Set of the integers 0..n-1 with O(1) insert, membership and clear,
+//and iteration in insertion order. Nothing is allocated after it has
+//been sized.
+class SparseSet {
+    private:
+        vector<int> dense;
+        vector<int> sparse;
+        int n;
+    public:
+        SparseSet(int maxSize = 0) : dense(maxSize), sparse(maxSize), n(0) { }
+        void resize(int maxSize) {
+            dense = vector<int>(maxSize);
+            sparse = vector<int>(maxSize);
+            n = 0;
+        }
+        bool contains(int s) {
+            int i = sparse[s];
+            return i < n && dense[i] == s;
+        }
+        void insert(int s) {
+            sparse[s] = n;
+            dense[n++] = s;
+        }
+        void clear() {
+            n = 0;
+        }
+        int size() {
+            return n;
+        }
+        int operator[](int i) {
+            return dense[i];
+        }
+        void swap(SparseSet& other) {
+            dense.swap(other.dense);
+            sparse.swap(other.sparse);
+            std::swap(n, other.n);
+        }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef reginst_hpp
+#define reginst_hpp
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "value.hpp"
+using namespace std;
+
+//Instruction set of the register machine. Operands a, b and c are
+//registers of the current frame unless noted:
+//
+//  MOV a b         a := b
+//  GETU a d i      a := register i of the frame active at depth d
+//  SETU a d i      register i of the frame active at depth d := a
+//  GETX a base i   a := global register base+i, for arrays
+//  SETX a base i   global register base+i := a
+//  ADD..GT a b c   a := b op c
+//  NEG, NOT a b    a := op b
+//  JMP a           jump to a
+//  JPC a b         jump to a if b is false
+//  EQUJ..GTJ a b c jump to a unless b relop c
+//  CAL a p c n     call procedure p with the n arguments from c up, a := result
+//  ENT p           clear the locals and load the constants of procedure p
+//  RES a           a is what the procedure returns, unless a later RES says otherwise
+//  RET             return to the caller
+//  PRINT a         print a
+//  MATCH a b c     a := b matches the pattern c
+//  HALT
+enum RegOp {
+    RMOV, RGETU, RSETU, RGETX, RSETX,
+    RADD, RSUB, RMUL, RDIV,
+    REQU, RNEQ, RLTE, RGTE, RLT, RGT,
+    RNEG, RNOT,
+    RJMP, RJPC,
+    REQUJ, RNEQJ, RLTEJ, RGTEJ, RLTJ, RGTJ,
+    RCAL, RENT, RRES, RRET,
+    RPRINT, RMATCH, RHALT
+};
+
+string regOpStr[] = {
+    "MOV", "GETU", "SETU", "GETX", "SETX",
+    "ADD", "SUB", "MUL", "DIV",
+    "EQU", "NEQ", "LTE", "GTE", "LT", "GT",
+    "NEG", "NOT",
+    "JMP", "JPC",
+    "EQUJ", "NEQJ", "LTEJ", "GTEJ", "LTJ", "GTJ",
+    "CAL", "ENT", "RES", "RET",
+    "PRINT", "MATCH", "HALT"
+};
+
+bool isRegBranch(RegOp op) {
+    switch (op) {
+        case RJMP: case RJPC:
+        case REQUJ: case RNEQJ: case RLTEJ:
+        case RGTEJ: case RLTJ: case RGTJ:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+struct RegInstruction {
+    RegOp op;
+    int a;
+    int b;
+    int c;
+    int n;
+    RegInstruction(RegOp o = RHALT, int x = 0, int y = 0, int z = 0, int w = 0) : op(o), a(x), b(y), c(z), n(w) { }
+};
+
+std::ostream& operator<<(std::ostream& os, const RegInstruction& inst) {
+    os<<"("<<setw(5)<<regOpStr[inst.op]<<", "<<setw(5)<<inst.a<<", "<<setw(5)<<inst.b<<", "<<setw(5)<<inst.c;
+    if (inst.op == RCAL)
+        os<<", "<<inst.n;
+    os<<")";
+    return os;
+}
+
+//A frame holds the procedure's parameters, then its locals, then its
+//constants, then the temporaries of the expressions in it. The main
+//program's frame is at the bottom of the register file and holds the
+//globals in place of parameters and locals.
+struct RegProcedure {
+    string name;
+    int entry;
+    int depth;
+    int numSlots;  //parameters and locals
+    int frameSize;
+    vector<Value> constants;
+    RegProcedure(string n = "", int d = 0) : name(n), entry(0), depth(d), numSlots(0), frameSize(0) { }
+};
+
+struct RegProgram {
+    vector<RegInstruction> code;
+    vector<RegProcedure> procedures; //the main program is procedure 0
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,303 @@
+#ifndef regmachine_hpp
+#define regmachine_hpp
+#include <iostream>
+#include <vector>
+#include "regex/re_cache.hpp"
+#include "value.hpp"
+#include "reginst.hpp"
+#include "pmachine.hpp"
+using namespace std;
+
+//what CAL saves for RET to restore
+struct CallRecord {
+    int returnAddr;
+    int fp;
+    int proc;
+    int dst;
+    int depth;
+    int savedDisplay;
+    bool hasResult;
+    Value result;
+    CallRecord(int ra, int f, int p, int d, int dp, int sd) : returnAddr(ra), fp(f), proc(p), dst(d), depth(dp), savedDisplay(sd), hasResult(false) { }
+};
+
+//Runs the code of RegisterCodeGenerator. Each active procedure has a
+//window of the register file starting at fp, the main program's window
+//is at 0 and holds the globals. display[d] is the fp of the frame active
+//at lexical depth d, as it is the base pointer of one on the P-machine.
+class RegisterVM {
+    private:
+        bool should_trace;
+        RegProgram program;
+        vector<Value> regs;
+        vector<CallRecord> calls;
+        RegExCache regexCache;
+        Value badAddress;
+        int display[MAX_DEPTH];
+        int regsTop; //high-water mark of the register file
+        int fp;
+        int ip;
+        int proc;   //procedure the active frame belongs to
+        int nargs;  //arguments passed to it, for ENT
+        Value* frame;
+        RegInstruction* curr;
+        RegInstruction& current() {
+            return *curr;
+        }
+        Value& reg(int r) {
+            return frame[r];
+        }
+        void growRegisters(int size) {
+            if (size >= GLOBAL_BASE) {
+                cout<<"Error: stack overflow"<<endl;
+                exit(EXIT_FAILURE);
+            }
+            if (size > regsTop)
+                regsTop = size;
+            if (size > regs.size())
+                regs.resize(max(2*(int)regs.size(), size));
+            frame = regs.data() + fp;
+        }
+        int getValue(Value val) {
+            return typeOf(val) == AS_INT ? getInteger(val):getReal(val);
+        }
+        //arrays are globals, so base is a register of the main frame,
+        //which holds all of every array
+        Value& globalAt(int addr) {
+            if (addr >= 0 && addr < program.procedures[0].numSlots)
+                return regs[addr];
+            cout<<"Error: invalid address: "<<GLOBAL_BASE + addr<<endl;
+            badAddress = makeNil();
+            return badAddress;
+        }
+        //the callee's frame starts past the caller's temporaries, the
+        //arguments are copied into its first registers
+        void callProcedure() {
+            RegProcedure& callee = program.procedures[current().b];
+            int args = current().c;
+            nargs = current().n;
+            int newfp = fp + program.procedures[proc].frameSize;
+            calls.push_back(CallRecord(ip, fp, proc, current().a, callee.depth, display[callee.depth]));
+            int oldfp = fp;
+            fp = newfp;
+            growRegisters(fp + max(callee.frameSize, nargs));
+            for (int i = 0; i < nargs; i++)
+                frame[i] = regs[oldfp + args + i];
+            display[callee.depth] = fp;
+            proc = current().b;
+            ip = callee.entry;
+        }
+        void enterProcedure() {
+            RegProcedure& p = program.procedures[current().a];
+            for (int i = nargs; i < p.numSlots; i++)
+                frame[i] = makeInt(0);
+            for (int i = 0; i < p.constants.size(); i++)
+                frame[p.numSlots + i] = p.constants[i];
+        }
+        //without a RES the result is the last parameter or local, which
+        //is what the P-machine finds on top of its stack then
+        void returnFromProcedure() {
+            CallRecord& rec = calls.back();
+            int slots = program.procedures[proc].numSlots;
+            Value result = rec.hasResult ? rec.result:(slots > 0 ? frame[slots-1]:makeInt(0));
+            display[rec.depth] = rec.savedDisplay;
+            fp = rec.fp;
+            frame = regs.data() + fp;
+            proc = rec.proc;
+            ip = rec.returnAddr;
+            frame[rec.dst] = result;
+            calls.pop_back();
+        }
+        void saveResult() {
+            calls.back().result = reg(current().a);
+            calls.back().hasResult = true;
+        }
+        void loadUplevel() {
+            reg(current().a) = regs[display[current().b] + current().c];
+        }
+        void storeUplevel() {
+            regs[display[current().b] + current().c] = reg(current().a);
+        }
+        void loadIndexed() {
+            reg(current().a) = globalAt(current().b + getValue(reg(current().c)));
+        }
+        void storeIndexed() {
+            globalAt(current().b + getValue(reg(current().c))) = reg(current().a);
+        }
+        void markValues(vector<Value>& region, int count) {
+            for (int i = 0; i < count; i++)
+                markValue(region[i]);
+        }
+        //As on the P-machine, loop back edges and calls are the safe points.
+        //Every frame is in the register file, so all of it that has been
+        //used is marked, along with what RES saved and the constants.
+        void collectGarbage() {
+            stringHeap.beginCollection();
+            markValues(regs, regsTop);
+            for (CallRecord& rec : calls)
+                if (rec.hasResult)
+                    markValue(rec.result);
+            for (RegProcedure& p : program.procedures)
+                markValues(p.constants, p.constants.size());
+            markValue(badAddress);
+            stringHeap.sweep();
+        }
+        inline void safePoint() {
+            if (stringHeap.wantsCollection())
+                collectGarbage();
+        }
+        void jump() {
+            int from = ip-1;
+            ip = current().a;
+            if (ip <= from)
+                safePoint();
+        }
+        void jumpConditional() {
+            if (getBoolean(reg(current().b)) == false)
+                ip = current().a;
+        }
+        template <Value (*intop)(int, int), Value (*op)(Value, Value)>
+        void binaryOperator() {
+            Value& lhs = reg(current().b);
+            Value& rhs = reg(current().c);
+            if (bothInts(lhs, rhs))
+                reg(current().a) = intop(getInteger(lhs), getInteger(rhs));
+            else
+                reg(current().a) = op(lhs, rhs);
+        }
+        template <Value (*intop)(int, int), Value (*op)(Value, Value)>
+        void compareAndBranch() {
+            Value& lhs = reg(current().b);
+            Value& rhs = reg(current().c);
+            Value result = bothInts(lhs, rhs) ? intop(getInteger(lhs), getInteger(rhs)):op(lhs, rhs);
+            if (getBoolean(result) == false)
+                ip = current().a;
+        }
+        template <bool tracing>
+        void matchRegExp() {
+            string text = toStdString(reg(current().b));
+            CompiledRegEx& re = regexCache.get(toStdString(reg(current().c)));
+            bool result;
+            if (tracing) {
+                RegExPatternMatcher pm(re.nfa, tracing);
+                result = pm.match(text);
+            } else {
+                result = re.dfa.match(text);
+            }
+            reg(current().a) = makeBool(result);
+        }
+        template <bool tracing>
+        void nextInstruction() {
+            curr = &program.code[ip++];
+            if (tracing)
+                cout<<"Executing: "<<ip-1<<": "<<current()<<" fp: "<<fp<<endl;
+        }
+        template <bool tracing>
+        void run() {
+#ifdef DALGOL_COMPUTED_GOTO
+            static const void* dispatchTable[] = {
+                &&op_RMOV, &&op_RGETU, &&op_RSETU, &&op_RGETX, &&op_RSETX,
+                &&op_RADD, &&op_RSUB, &&op_RMUL, &&op_RDIV,
+                &&op_REQU, &&op_RNEQ, &&op_RLTE, &&op_RGTE, &&op_RLT, &&op_RGT,
+                &&op_RNEG, &&op_RNOT,
+                &&op_RJMP, &&op_RJPC,
+                &&op_REQUJ, &&op_RNEQJ, &&op_RLTEJ, &&op_RGTEJ, &&op_RLTJ, &&op_RGTJ,
+                &&op_RCAL, &&op_RENT, &&op_RRES, &&op_RRET,
+                &&op_RPRINT, &&op_RMATCH, &&op_RHALT
+            };
+            #define vmcase(op) op_##op:
+            #define vmnext() { nextInstruction<tracing>(); goto *dispatchTable[current().op]; }
+            nextInstruction<tracing>();
+            goto *dispatchTable[current().op];
+#else
+            #define vmcase(op) case op:
+            #define vmnext() break
+            for (;;) {
+                nextInstruction<tracing>();
+                switch (current().op) {
+#endif
+                    vmcase(RMOV) { reg(current().a) = reg(current().b); } vmnext();
+                    vmcase(RGETU) { loadUplevel(); } vmnext();
+                    vmcase(RSETU) { storeUplevel(); } vmnext();
+                    vmcase(RGETX) { loadIndexed(); } vmnext();
+                    vmcase(RSETX) { storeIndexed(); } vmnext();
+                    vmcase(RADD) { binaryOperator<addInt, Add>(); } vmnext();
+                    vmcase(RSUB) { binaryOperator<subInt, Sub>(); } vmnext();
+                    vmcase(RMUL) { binaryOperator<mulInt, Mul>(); } vmnext();
+                    vmcase(RDIV) { binaryOperator<divInt, Div>(); } vmnext();
+                    vmcase(REQU) { binaryOperator<equInt, equ>(); } vmnext();
+                    vmcase(RNEQ) { binaryOperator<neqInt, neq>(); } vmnext();
+                    vmcase(RLTE) { binaryOperator<lteInt, lte>(); } vmnext();
+                    vmcase(RGTE) { binaryOperator<gteInt, gte>(); } vmnext();
+                    vmcase(RLT) { binaryOperator<ltInt, lt>(); } vmnext();
+                    vmcase(RGT) { binaryOperator<gtInt, gt>(); } vmnext();
+                    vmcase(RNEG) { reg(current().a) = Neg(reg(current().b)); } vmnext();
+                    vmcase(RNOT) { reg(current().a) = Not(reg(current().b)); } vmnext();
+                    vmcase(RJMP) { jump(); } vmnext();
+                    vmcase(RJPC) { jumpConditional(); } vmnext();
+                    vmcase(REQUJ) { compareAndBranch<equInt, equ>(); } vmnext();
+                    vmcase(RNEQJ) { compareAndBranch<neqInt, neq>(); } vmnext();
+                    vmcase(RLTEJ) { compareAndBranch<lteInt, lte>(); } vmnext();
+                    vmcase(RGTEJ) { compareAndBranch<gteInt, gte>(); } vmnext();
+                    vmcase(RLTJ) { compareAndBranch<ltInt, lt>(); } vmnext();
+                    vmcase(RGTJ) { compareAndBranch<gtInt, gt>(); } vmnext();
+                    vmcase(RCAL) { callProcedure(); safePoint(); } vmnext();
+                    vmcase(RENT) { enterProcedure(); } vmnext();
+                    vmcase(RRES) { saveResult(); } vmnext();
+                    vmcase(RRET) { returnFromProcedure(); } vmnext();
+                    vmcase(RPRINT) { cout<<"\t\t\t\t\t"<<toStdString(reg(current().a))<<endl; } vmnext();
+                    vmcase(RMATCH) { matchRegExp<tracing>(); } vmnext();
+                    vmcase(RHALT) { return; }
+#ifndef DALGOL_COMPUTED_GOTO
+                }
+            }
+#endif
+            #undef vmcase
+            #undef vmnext
+        }
+    public:
+        RegisterVM(bool trace = false) {
+            should_trace = trace;
+            regsTop = 0;
+            fp = 0;
+            ip = 0;
+            proc = 0;
+            nargs = 0;
+            frame = nullptr;
+            badAddress = makeNil();
+            for (int i = 0; i < MAX_DEPTH; i++)
+                display[i] = 0;
+        }
+        void setTrace(bool trace) {
+            should_trace = trace;
+        }
+        void init(RegProgram& prog) {
+            program = prog;
+            regs = vector<Value>(max(1024, program.procedures[0].frameSize));
+            calls.clear();
+            fp = 0;
+            ip = 0;
+            proc = 0;
+            nargs = 0;
+            growRegisters(program.procedures[0].frameSize);
+        }
+        void execute() {
+            stringHeap.setManaged(true);
+            if (should_trace)
+                run<true>();
+            else
+                run<false>();
+            stringHeap.setManaged(false);
+        }
+        void setHeapLimit(size_t maxBytes) {
+            stringHeap.setLimit(maxBytes);
+        }
+        void printGCStats() {
+            stringHeap.printStats();
+        }
+        int registerHighWater() {
+            return regsTop;
+        }
+};
+
+#endif
\ No newline at end of file
@@ -2,7 +2,9 @@
 #define scoping_st_hpp
 #include <iostream>
 #include <unordered_map>
+#include "arena.hpp"
 #include "syntaxtree.hpp"
+#include "memory_layout.hpp"
 using namespace std;
 
 
@@ -49,10 +51,12 @@ struct STEntry {
 
 struct Scope {
     int numEntries;
+    int depth;
     STEntry* table[TABLE_SIZE];
     Scope* enclosing;
     Scope() {
         numEntries = 0;
+        depth = 0;
         enclosing = nullptr;
         for (int i = 0; i < TABLE_SIZE; i++) {
             table[i] = nullptr;
@@ -60,41 +64,46 @@ struct Scope {
     }
 };
 
-STEntry* makeLocalVarEntry(string name, int location, int depth) {
-    STEntry* ent = new STEntry(name);
+STEntry* makeLocalVarEntry(Arena& arena, string name, int location, int depth) {
+    STEntry* ent = arena.make<STEntry>(name);
     ent->type = VARDEF;
-    ent->localvar = new LocalVar(location, depth);
+    ent->localvar = arena.make<LocalVar>(location, depth);
     return ent;
 }
 
-STEntry* makeProcedureEntry(string name, Scope* ns) {
-    STEntry* ent = new STEntry(name);
+STEntry* makeProcedureEntry(Arena& arena, string name, Scope* ns) {
+    STEntry* ent = arena.make<STEntry>(name);
     ent->type = PROCDEF;
     ent->procedure = ns;
     return ent;
 }
 
-STEntry* makeStructEntry(string name, Scope* ns, int addr) {
-    STEntry* ent = new STEntry(name);
+STEntry* makeStructEntry(Arena& arena, string name, Scope* ns, int addr) {
+    STEntry* ent = arena.make<STEntry>(name);
     ent->type = STRUCTDEF;
     ent->structure = ns;
     ent->addr = addr;
     return ent;
 }
 
-STEntry* makeEmptyEntry() {
-    STEntry* ent = new STEntry("<empty>");
+STEntry* makeEmptyEntry(Arena& arena) {
+    STEntry* ent = arena.make<STEntry>("<empty>");
     ent->type = EMPTY;
     ent->localvar = nullptr;
     return ent;
 }
 
+//Every entry, variable and scope is made in the table's arena, and goes
+//when the table does. A failed lookup returns the one EMPTY entry.
 class ScopingSymbolTable {
     private:
         bool should_trace;
+        Arena arena;
+        STEntry* empty;
         Scope* scope;
         int scopeDepth;
-        int localAddr;
+        int globalAddr;
+        int fieldsEnd; //fields of a global instance are read off its own slot
         int heapAddr;
         vector<int> freelist;
         unordered_map<string, string> instanceTypes;
@@ -118,7 +127,7 @@ class ScopingSymbolTable {
             }
             if (should_trace)
                 cout<<"Not found."<<endl;
-            return makeEmptyEntry();
+            return empty;
         }
         void dump(Scope* s, int sd) {
             if (s == nullptr) return;
@@ -156,17 +165,23 @@ class ScopingSymbolTable {
         }
     public:
         ScopingSymbolTable() {
-            scope = new Scope();
+            empty = makeEmptyEntry(arena);
+            scope = arena.make<Scope>();
             scope->enclosing = nullptr;
             scopeDepth = 0;
-            localAddr = 5000;
-            heapAddr = 6999;
+            globalAddr = GLOBAL_BASE;
+            fieldsEnd = GLOBAL_BASE;
+            heapAddr = HEAP_BASE;
             should_trace = false;
         }
         int scopeSize(string name) {
             Scope* sc = getProc(name);
             return sc == nullptr ? 0:sc->numEntries;
         }
+        int scopeLevel(string name) {
+            Scope* sc = getProc(name);
+            return sc == nullptr ? 0:sc->depth;
+        }
         void setTrace(bool trace) {
             should_trace = trace;
         }
@@ -178,17 +193,13 @@ class ScopingSymbolTable {
             }
             int addr = 0;
             if (scopeIsGlobal()) {
-                addr = localAddr;
-                localAddr -= size;
+                addr = globalAddr;
+                globalAddr += size;
             } else {
-                if (size == 1) {
-                    addr = scope->numEntries;
-                } else {
-                    addr = scope->numEntries + size;
-                }
+                addr = scope->numEntries;
                 scope->numEntries += size;
             }
-            STEntry* nent = makeLocalVarEntry(name, addr, scopeDepth);
+            STEntry* nent = makeLocalVarEntry(arena, name, addr, scopeDepth);
             if (size > 1) { 
                 nent->localvar->type = ARRAY;
                 nent->localvar->size = size;
@@ -205,19 +216,30 @@ class ScopingSymbolTable {
             if (ent->type == VARDEF) {
                 return ent->localvar;
             } else if (ent->type == STRUCTDEF) {
-                return new LocalVar(ent->addr, 0);
+                return arena.make<LocalVar>(ent->addr, 0);
             }
             return nullptr;
         }
+        //looks name up as the body of procedure procName would see it
+        LocalVar* getVarFrom(string procName, string name) {
+            Scope* sc = getProc(procName);
+            if (sc == nullptr)
+                return getVar(name);
+            Scope* saved = scope;
+            scope = sc;
+            LocalVar* lv = getVar(name);
+            scope = saved;
+            return lv;
+        }
         Scope* insertProc(string name) {
             int idx = hashf(name);
             for (STEntry* it = scope->table[idx]; it != nullptr; it = it->next) {
                 if (it->name == name)
                     return it->procedure;
             }
-            Scope* ns = new Scope();
+            Scope* ns = arena.make<Scope>();
             ns->enclosing = scope;
-            STEntry* nent = makeProcedureEntry(name, ns);
+            STEntry* nent = makeProcedureEntry(arena, name, ns);
             nent->next = scope->table[idx]; 
             scope->table[idx] = nent;
             return ns;
@@ -234,6 +256,7 @@ class ScopingSymbolTable {
             st->enclosing = scope;
             scope = st;
             scopeDepth++;
+            st->depth = scopeDepth;
             if (should_trace)
                 cout<<"Open scope for: "<<name<<endl;
         }
@@ -251,11 +274,11 @@ class ScopingSymbolTable {
                 if (it->name == name)
                     return it->structure;
             }
-            Scope* ns = new Scope();
+            Scope* ns = arena.make<Scope>();
             ns->enclosing = scope;
-            int addr = localAddr;
-            localAddr -= size;
-            STEntry* nent = makeStructEntry(name, ns, addr);
+            int addr = globalAddr;
+            globalAddr += size;
+            STEntry* nent = makeStructEntry(arena, name, ns, addr);
             nent->next = scope->table[idx]; 
             scope->table[idx] = nent;
             return ns;
@@ -282,6 +305,10 @@ class ScopingSymbolTable {
         }
         void addInstanceType(string instanceName, string typeName) {
             instanceTypes[instanceName] = typeName;
+            STEntry* ent = get(instanceName);
+            Scope* st = getStruct(typeName);
+            if (scopeIsGlobal() && ent->localvar != nullptr && st != nullptr)
+                fieldsEnd = max(fieldsEnd, ent->localvar->loc + st->numEntries + 1);
             cout<<instanceName<<" is an instance of "<<typeName<<endl;
         }
         void openStruct(ASTNode* node) {
@@ -316,13 +343,20 @@ class ScopingSymbolTable {
                 cout<<"Error: no such type: "<<name<<endl;
                 return -1;
             }
-            int nextAddr = heapAddr--;
-            heapAddr -= st->numEntries;
+            int nextAddr = heapAddr;
+            heapAddr += st->numEntries + 1;
             return nextAddr;
         }
         STEntry* getEntry(string name) {
             return get(name);
         }
+        //one past the last global and heap address handed out
+        int globalsEnd() {
+            return max(globalAddr, fieldsEnd);
+        }
+        int heapEnd() {
+            return heapAddr;
+        }
         void print() {
             cout<<"Symbol Table: "<<endl;
             dump(scope, 0);
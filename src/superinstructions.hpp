@@ -0,0 +1,186 @@
+#ifndef superinstructions_hpp
+#define superinstructions_hpp
+#include <iostream>
+#include <vector>
+#include "vminst.hpp"
+using namespace std;
+
+//Fuses the instruction sequences PCodeGenerator emits most often
+//into single superinstructions:
+//
+//  LDA x; LOD x; LDC k; ADD; STO   ->  INCV x, k     (x := x + k)
+//  LDA x; LOD x; LDC k; SUB; STO   ->  DECV x, k     (x := x - k)
+//  LOD x; LDC k; ADD               ->  LADD x, k
+//  LOD x; LDC k; SUB               ->  LSUB x, k
+//  LDC k; ADD|SUB|MUL              ->  ADDC|SUBC|MULC k
+//  LOD x; ADD|SUB|MUL              ->  ADDL|SUBL|MULL x
+//  relop; JPC L                    ->  EQUJ|NEQJ|..|GTJ L
+//  numeric relop; JPC L            ->  NEQUJ|NNEQJ|..|NGTJ L
+//
+//A sequence is only fused when none of its instructions other than
+//the first is a branch target. Every branch is relocated afterwards.
+class SuperInstructionPass {
+    private:
+        int fused;
+        int removed;
+        vector<bool> targets;
+        bool isTarget(int addr) {
+            return addr >= 0 && addr < targets.size() && targets[addr];
+        }
+        void markTargets(vector<Instruction>& code) {
+            targets = vector<bool>(code.size(), false);
+            for (Instruction& inst : code) {
+                int addr = getInteger(inst.operand);
+                if (isBranchInst(inst.instruction) && addr >= 0 && addr < targets.size())
+                    targets[addr] = true;
+            }
+        }
+        bool hasInterior(vector<Instruction>& code, int pos, int len) {
+            if (pos + len > code.size())
+                return false;
+            for (int i = pos+1; i < pos+len; i++)
+                if (isTarget(i))
+                    return false;
+            return true;
+        }
+        bool isSmallInt(Instruction& inst) {
+            if (inst.instruction != LDC || typeOf(inst.operand) != AS_INT)
+                return false;
+            return getInteger(inst.operand) >= INT16_MIN && getInteger(inst.operand) <= INT16_MAX;
+        }
+        bool sameVar(Instruction& a, Instruction& b) {
+            return getInteger(a.operand) == getInteger(b.operand) && getInteger(a.nestlevel) == getInteger(b.nestlevel);
+        }
+        //the numeric forms fuse as the generic ones would, the
+        //superinstructions make no assumption about types
+        Inst generic(Inst op) {
+            switch (op) {
+                case NADD: return ADD;
+                case NSUB: return SUB;
+                case NMUL: return MUL;
+                default: break;
+            }
+            return op;
+        }
+        Inst withConstant(Inst op) {
+            switch (generic(op)) {
+                case ADD: return ADDC;
+                case SUB: return SUBC;
+                case MUL: return MULC;
+                default: break;
+            }
+            return HALT;
+        }
+        Inst withLocal(Inst op) {
+            switch (generic(op)) {
+                case ADD: return ADDL;
+                case SUB: return SUBL;
+                case MUL: return MULL;
+                default: break;
+            }
+            return HALT;
+        }
+        Inst withBranch(Inst op) {
+            switch (op) {
+                case EQU: return EQUJ;
+                case NEQ: return NEQJ;
+                case LTE: return LTEJ;
+                case GTE: return GTEJ;
+                case LT:  return LTJ;
+                case GT:  return GTJ;
+                case NEQU: return NEQUJ;
+                case NNEQ: return NNEQJ;
+                case NLTE: return NLTEJ;
+                case NGTE: return NGTEJ;
+                case NLT:  return NLTJ;
+                case NGT:  return NGTJ;
+                default: break;
+            }
+            return HALT;
+        }
+        //returns the number of instructions consumed from code[pos]
+        int fuse(vector<Instruction>& code, int pos, Instruction& out) {
+            Instruction& a = code[pos];
+            if (a.instruction == LDA && hasInterior(code, pos, 5)) {
+                Instruction& b = code[pos+1];
+                Instruction& c = code[pos+2];
+                Inst d = generic(code[pos+3].instruction);
+                if (b.instruction == LOD && sameVar(a, b) && isSmallInt(c) &&
+                    (d == ADD || d == SUB) && code[pos+4].instruction == STO) {
+                    out = Instruction(d == ADD ? INCV:DECV, b.operand, b.nestlevel, getInteger(c.operand));
+                    return 5;
+                }
+            }
+            if (a.instruction == LOD && hasInterior(code, pos, 3)) {
+                Instruction& b = code[pos+1];
+                Inst c = generic(code[pos+2].instruction);
+                if (isSmallInt(b) && (c == ADD || c == SUB)) {
+                    out = Instruction(c == ADD ? LADD:LSUB, a.operand, a.nestlevel, getInteger(b.operand));
+                    return 3;
+                }
+            }
+            if (hasInterior(code, pos, 2)) {
+                Instruction& b = code[pos+1];
+                if (a.instruction == LDC && typeOf(a.operand) == AS_INT && withConstant(b.instruction) != HALT) {
+                    out = Instruction(withConstant(b.instruction), a.operand);
+                    return 2;
+                }
+                if (a.instruction == LOD && withLocal(b.instruction) != HALT) {
+                    out = Instruction(withLocal(b.instruction), a.operand, a.nestlevel);
+                    return 2;
+                }
+                if (withBranch(a.instruction) != HALT && b.instruction == JPC) {
+                    out = Instruction(withBranch(a.instruction), b.operand);
+                    return 2;
+                }
+            }
+            out = a;
+            return 1;
+        }
+    public:
+        SuperInstructionPass() {
+            fused = 0;
+            removed = 0;
+        }
+        vector<Instruction> run(vector<Instruction>& code) {
+            vector<Instruction> result;
+            vector<int> relocated(code.size()+1);
+            fused = 0;
+            removed = 0;
+            markTargets(code);
+            result.reserve(code.size());
+            int pos = 0;
+            while (pos < code.size()) {
+                Instruction inst;
+                int len = fuse(code, pos, inst);
+                for (int i = pos; i < pos+len; i++)
+                    relocated[i] = result.size();
+                if (len > 1) {
+                    fused++;
+                    removed += len-1;
+                }
+                result.push_back(inst);
+                pos += len;
+            }
+            relocated[code.size()] = result.size();
+            for (Instruction& inst : result) {
+                if (isBranchInst(inst.instruction)) {
+                    int addr = getInteger(inst.operand);
+                    if (addr >= 0 && addr < relocated.size())
+                        inst.operand = makeInt(relocated[addr]);
+                }
+            }
+            return result;
+        }
+        int fusedCount() {
+            return fused;
+        }
+        int removedCount() {
+            return removed;
+        }
+        void printStats() {
+            cout<<"Superinstructions: "<<fused<<" formed, "<<removed<<" instructions fused away."<<endl;
+        }
+};
+
+#endif
\ No newline at end of file
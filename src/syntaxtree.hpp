@@ -1,6 +1,8 @@
 #ifndef syntaxtree_hpp
 #define syntaxtree_hpp
+#include "arena.hpp"
 #include "token.hpp"
+#include "value.hpp"
 
 enum NodeKind {
     EXPR_NODE, STMT_NODE
@@ -52,6 +54,7 @@ struct ASTNode {
     } type;
     Attributes attributes;
     Token data;
+    Value value; //the number a CONST_EXPR stands for, parsed once
     ASTNode* next; 
     ASTNode* child[MAXCHILD];
     ASTNode() {
@@ -61,16 +64,16 @@ struct ASTNode {
     }
 };
 
-ASTNode* makeExprNode(ExprType et, Token t) {
-    ASTNode* nn = new ASTNode();
+ASTNode* makeExprNode(Arena& arena, ExprType et, Token t) {
+    ASTNode* nn = arena.make<ASTNode>();
     nn->nk = EXPR_NODE;
     nn->type.expr = et;
     nn->data = t;
     return nn;
 }
 
-ASTNode* makeStmtNode(StmtType st, Token t) {
-    ASTNode* nn = new ASTNode();
+ASTNode* makeStmtNode(Arena& arena, StmtType st, Token t) {
+    ASTNode* nn = arena.make<ASTNode>();
     nn->nk = STMT_NODE;
     nn->type.stmt = st;
     nn->data = t;
@@ -98,13 +101,4 @@ void traverse(ASTNode* node) {
     depth--;
 }
 
-void cleanup(ASTNode* node) {
-    if (node != nullptr) {
-        cleanup(node->next);
-        for (int i = 0; i < MAXCHILD; i++)
-            cleanup(node->child[0]);
-        delete node;
-    }
-}
-
 #endif
\ No newline at end of file
@@ -0,0 +1,360 @@
+#ifndef typeinfer_hpp
+#define typeinfer_hpp
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+#include "syntaxtree.hpp"
+#include "value.hpp"
+#include "vminst.hpp"
+using namespace std;
+
+//Flow sensitive type inference, one procedure at a time, over the AST
+//PCodeGenerator walks. Every expression is given the type it is known to
+//have at runtime, which lets the code generator pick an opcode that skips
+//the type dispatch of the generic one:
+//
+//  num + num, num - num, num * num  ->  NADD, NSUB, NMUL
+//  num relop num                    ->  NEQU .. NGT
+//  string + anything                ->  CAT
+//
+//A number is an int or a real: int arithmetic overflows into reals, so an
+//int can't be told from a real before runtime, but neither can be a string
+//or a bool. Only variables that nothing but straight line code in the
+//procedure can touch are tracked: declared once by a let, never captured
+//by a nested procedure, aliased by a ref, indexed, or passed to what could
+//be a ref parameter. Anything else is IR_ANY and gets the generic opcode.
+enum IRType {
+    IR_NONE, IR_NUM, IR_STRING, IR_BOOL, IR_ANY
+};
+
+typedef unordered_map<string, IRType> TypeEnv;
+
+class TypeInference {
+    private:
+        bool enabled;
+        int specialized;
+        int operators;
+        unordered_map<ASTNode*, IRType> types;
+        unordered_map<string, ASTNode*> procedures;
+        unordered_set<string> tracked;
+        TypeEnv env;
+        bool isStmt(ASTNode* node, StmtType type) {
+            return node != nullptr && node->nk == STMT_NODE && node->type.stmt == type;
+        }
+        bool isExpr(ASTNode* node, ExprType type) {
+            return node != nullptr && node->nk == EXPR_NODE && node->type.expr == type;
+        }
+        bool isPlainID(ASTNode* node) {
+            return isExpr(node, ID_EXPR) && node->child[0] == nullptr;
+        }
+        IRType join(IRType a, IRType b) {
+            return a == b ? a:IR_ANY;
+        }
+        TypeEnv join(TypeEnv& a, TypeEnv& b) {
+            TypeEnv result;
+            for (string name : tracked) {
+                auto x = a.find(name), y = b.find(name);
+                result[name] = join(x == a.end() ? IR_NONE:x->second, y == b.end() ? IR_NONE:y->second);
+            }
+            return result;
+        }
+        void findProcedures(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, FUNC_DEF_STMT))
+                    procedures[node->data.strval] = node;
+                for (int i = 0; i < MAXCHILD; i++)
+                    findProcedures(node->child[i]);
+            }
+        }
+        void mentionedNames(ASTNode* node, unordered_set<string>& names) {
+            for (; node != nullptr; node = node->next) {
+                if (isExpr(node, ID_EXPR) || isStmt(node, LET_STMT) || isStmt(node, REF_STMT))
+                    names.insert(node->data.strval);
+                for (int i = 0; i < MAXCHILD; i++)
+                    mentionedNames(node->child[i], names);
+            }
+        }
+        //an argument may be assigned to by the callee unless it is
+        //known to be passed to a let parameter
+        void untrackRefArgs(ASTNode* call, unordered_set<string>& untracked) {
+            auto it = procedures.find(call->data.strval);
+            ASTNode* param = it == procedures.end() ? nullptr:it->second->child[0];
+            for (ASTNode* arg = call->child[1]; arg != nullptr; arg = arg->next) {
+                if (isExpr(arg, ID_EXPR) && !isStmt(param, LET_STMT))
+                    untracked.insert(arg->data.strval);
+                if (param != nullptr)
+                    param = param->next;
+            }
+        }
+        //walks the procedure's own code, nested procedures are only searched
+        //for the names they capture
+        void scanRegion(ASTNode* node, unordered_map<string, int>& lets, unordered_set<string>& untracked) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, FUNC_DEF_STMT)) {
+                    mentionedNames(node->child[0], untracked);
+                    mentionedNames(node->child[1], untracked);
+                    continue;
+                }
+                if (isStmt(node, LET_STMT)) {
+                    lets[node->data.strval]++;
+                    ASTNode* init = node->child[0];
+                    if (init == nullptr || isExpr(init, SUBSCRIPT_EXPR) || isExpr(init, BLESS_EXPR))
+                        untracked.insert(node->data.strval);
+                } else if (isStmt(node, REF_STMT)) {
+                    untracked.insert(node->data.strval);
+                    mentionedNames(node->child[0], untracked);
+                } else if (isExpr(node, ID_EXPR) && node->child[0] != nullptr) {
+                    untracked.insert(node->data.strval);
+                } else if (isExpr(node, FUNC_EXPR)) {
+                    untrackRefArgs(node, untracked);
+                } else if (isStmt(node, STRUCT_STMT)) {
+                    continue;
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    scanRegion(node->child[i], lets, untracked);
+            }
+        }
+        IRType typeOfConstant(Value val) {
+            switch (typeOf(val)) {
+                case AS_INT:
+                case AS_REAL: return IR_NUM;
+                case AS_BOOL: return IR_BOOL;
+                case AS_STRING: return IR_STRING;
+                default: break;
+            }
+            return IR_ANY;
+        }
+        IRType lookupVar(string& name) {
+            auto it = env.find(name);
+            return it == env.end() || it->second == IR_NONE ? IR_ANY:it->second;
+        }
+        void assignVar(string& name, IRType type) {
+            if (tracked.count(name))
+                env[name] = type;
+        }
+        IRType binOpType(int op, IRType lhs, IRType rhs) {
+            switch (op) {
+                case TK_ADD:
+                    if (lhs == IR_STRING || rhs == IR_STRING)
+                        return IR_STRING;
+                    return lhs == IR_NUM && rhs == IR_NUM ? IR_NUM:IR_ANY;
+                case TK_MUL:
+                    if (lhs == IR_STRING || rhs == IR_STRING)
+                        return IR_STRING;
+                    return lhs == IR_NUM && rhs == IR_NUM ? IR_NUM:IR_ANY;
+                case TK_SUB:
+                case TK_DIV:
+                    //Sub and Div give a number whatever the operands,
+                    //0 for any, strings included, they don't apply to
+                    return IR_NUM;
+                default:
+                    break;
+            }
+            return IR_ANY;
+        }
+        void exprList(ASTNode* node) {
+            for (; node != nullptr; node = node->next)
+                expr(node);
+        }
+        //expressions are visited in the order their code runs,
+        //so assignments inside them are seen where they happen
+        IRType expr(ASTNode* node) {
+            IRType type = IR_ANY;
+            switch (node->type.expr) {
+                case CONST_EXPR:
+                    type = typeOfConstant(node->value);
+                    break;
+                case STR_EXPR:
+                    type = IR_STRING;
+                    break;
+                case ID_EXPR: {
+                    if (node->child[0] == nullptr)
+                        type = tracked.count(node->data.strval) ? lookupVar(node->data.strval):IR_ANY;
+                    else
+                        exprList(node->child[0]);
+                } break;
+                case BINOP_EXPR: {
+                    IRType lhs = expr(node->child[0]);
+                    IRType rhs = expr(node->child[1]);
+                    type = binOpType(node->data.symbol, lhs, rhs);
+                } break;
+                case RELOP_EXPR: {
+                    expr(node->child[0]);
+                    expr(node->child[1]);
+                    type = IR_BOOL;
+                } break;
+                case UNOP_EXPR: {
+                    ASTNode* arg = node->child[0];
+                    IRType operand = expr(arg);
+                    switch (node->data.symbol) {
+                        case TK_SUB: type = IR_NUM; break;
+                        case TK_NOT: type = operand == IR_BOOL ? IR_BOOL:IR_ANY; break;
+                        case TK_POST_INC:
+                        case TK_POST_DEC: {
+                            if (isPlainID(arg))
+                                assignVar(arg->data.strval, binOpType(TK_ADD, operand, IR_NUM));
+                            type = operand;
+                        } break;
+                        default: break;
+                    }
+                } break;
+                case ASSIGN_EXPR: {
+                    ASTNode* target = node->child[0];
+                    if (!isPlainID(target))
+                        expr(target);
+                    type = expr(node->child[1]);
+                    if (isPlainID(target))
+                        assignVar(target->data.strval, type);
+                    else
+                        type = IR_ANY;
+                } break;
+                case FUNC_EXPR:
+                    exprList(node->child[1]);
+                    break;
+                case REG_EXPR:
+                    expr(node->child[0]);
+                    expr(node->child[1]);
+                    type = IR_BOOL;
+                    break;
+                default:
+                    break;
+            }
+            types[node] = type;
+            return type;
+        }
+        void stmts(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                switch (node->type.stmt) {
+                    case LET_STMT: {
+                        ASTNode* init = node->child[0];
+                        if (init == nullptr || isExpr(init, SUBSCRIPT_EXPR) || isExpr(init, BLESS_EXPR))
+                            break;
+                        assignVar(node->data.strval, expr(init));
+                    } break;
+                    case PRINT_STMT:
+                    case EXPR_STMT:
+                    case RETURN_STMT:
+                        if (node->child[0] != nullptr)
+                            expr(node->child[0]);
+                        break;
+                    case IF_STMT: {
+                        expr(node->child[0]);
+                        TypeEnv before = env;
+                        stmts(node->child[1]);
+                        TypeEnv taken = env;
+                        env = before;
+                        stmts(node->child[2]);
+                        env = join(taken, env);
+                    } break;
+                    case WHILE_STMT: {
+                        //the body is walked again until the types at the
+                        //loop head stop changing, each type only ever
+                        //moves up to IR_ANY so that happens quickly.
+                        for (;;) {
+                            TypeEnv head = env;
+                            expr(node->child[0]);
+                            TypeEnv exit = env;
+                            stmts(node->child[1]);
+                            env = join(head, env);
+                            if (env == head) {
+                                env = exit;
+                                break;
+                            }
+                        }
+                    } break;
+                    case BLOCK_STMT:
+                        stmts(node->child[0]);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        void inferProcedure(ASTNode* params, ASTNode* body) {
+            unordered_map<string, int> lets;
+            unordered_set<string> untracked;
+            for (ASTNode* p = params; p != nullptr; p = p->next) {
+                lets[p->data.strval]++;
+                if (!isStmt(p, LET_STMT))
+                    untracked.insert(p->data.strval);
+            }
+            scanRegion(body, lets, untracked);
+            tracked.clear();
+            env.clear();
+            for (auto& let : lets)
+                if (let.second == 1 && untracked.count(let.first) == 0)
+                    tracked.insert(let.first);
+            for (ASTNode* p = params; p != nullptr; p = p->next)
+                assignVar(p->data.strval, IR_ANY);
+            stmts(body);
+            inferNested(body);
+        }
+        void inferNested(ASTNode* node) {
+            for (; node != nullptr; node = node->next) {
+                if (isStmt(node, FUNC_DEF_STMT)) {
+                    inferProcedure(node->child[0], node->child[1]);
+                    continue;
+                }
+                for (int i = 0; i < MAXCHILD; i++)
+                    if (node->child[i] != nullptr && node->child[i]->nk == STMT_NODE)
+                        inferNested(node->child[i]);
+            }
+        }
+        IRType typeOfExpr(ASTNode* node) {
+            auto it = types.find(node);
+            return it == types.end() ? IR_ANY:it->second;
+        }
+        Inst numericOp(Inst op) {
+            switch (op) {
+                case ADD: return NADD;
+                case SUB: return NSUB;
+                case MUL: return NMUL;
+                case EQU: return NEQU;
+                case NEQ: return NNEQ;
+                case LTE: return NLTE;
+                case GTE: return NGTE;
+                case LT:  return NLT;
+                case GT:  return NGT;
+                default: break;
+            }
+            return op;
+        }
+    public:
+        TypeInference() {
+            enabled = true;
+            specialized = 0;
+            operators = 0;
+        }
+        void setEnabled(bool enable) {
+            enabled = enable;
+        }
+        void infer(ASTNode* ast) {
+            types.clear();
+            procedures.clear();
+            specialized = operators = 0;
+            if (!enabled)
+                return;
+            findProcedures(ast);
+            //the main program, or a line typed into the repl
+            inferProcedure(nullptr, isStmt(ast, PROGRAM_STMT) ? ast->child[0]:ast);
+        }
+        //the opcode for the generic op applied by the BINOP or RELOP node
+        Inst opcodeFor(ASTNode* node, Inst op) {
+            operators++;
+            IRType lhs = typeOfExpr(node->child[0]);
+            IRType rhs = typeOfExpr(node->child[1]);
+            Inst typed = op;
+            if (lhs == IR_NUM && rhs == IR_NUM)
+                typed = numericOp(op);
+            else if (op == ADD && (lhs == IR_STRING || rhs == IR_STRING))
+                typed = CAT;
+            if (typed != op)
+                specialized++;
+            return typed;
+        }
+        void printStats() {
+            cout<<"Type inference: "<<specialized<<" of "<<operators<<" operators specialized."<<endl;
+        }
+};
+
+#endif
\ No newline at end of file
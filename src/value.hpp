@@ -3,31 +3,21 @@
 #include <iostream>
 #include <cstring>
 #include <cmath>
-#include "syntaxtree.hpp"
+#include <climits>
+#include <cstdint>
+#include "gc.hpp"
 using namespace std;
 
 enum ValueType {
     AS_INT, AS_BOOL, AS_REAL, AS_STRING, AS_FUNC, AS_NIL, AS_ARRDEF
 };
 
-struct String {
-    char* str;
-    int len;
-};
-
 String* createString(const char* str, int len) {
-    String* ns = new String;
-    ns->str = new char[len];
-    int i;
-    for (i = 0; str[i]; i++) {
-        ns->str[i] = str[i];
-    }
-    ns->str[i] = '\0';
-    ns->len = len;
-    return ns;
+    return stringHeap.make(str, len);
 }
 
 std::ostream& operator<<(std::ostream& os, String& strObj) {
+    stringHeap.flatten(&strObj);
     for (int i = 0; i < strObj.len; i++)
         os<<strObj.str[i];
     return os;
@@ -43,28 +33,149 @@ struct Function {
     name(n), ip(i), returnAddr(ra), numArgs(na), numLocals(nl) { }
 };
 
+#ifdef DALGOL_NAN_BOXING
+//NaN-boxed representation: a Value is a single 64 bit word. Any double
+//that is not a NaN is stored as itself, every other type lives in the
+//payload of a negative quiet NaN:
+//
+//  1111 1111 1111 1ttt  pppp .... pppp
+//  |   NaN prefix  |tag|  48 bit payload
+//
+//tag is the ValueType + 1, so a tag of 0 is still an ordinary double.
+//Pointers fit in the payload on the 48 bit address spaces we target.
+const uint64_t NANBOX_PREFIX = 0xFFF8000000000000ULL;
+const uint64_t NANBOX_PAYLOAD = 0x0000FFFFFFFFFFFFULL;
+const uint64_t CANONICAL_NAN = 0x7FF8000000000000ULL;
+
+constexpr uint64_t boxValue(ValueType type, uint64_t payload) {
+    return NANBOX_PREFIX | ((uint64_t)(type + 1) << 48) | (payload & NANBOX_PAYLOAD);
+}
+
+struct Value {
+    uint64_t bits = boxValue(AS_INT, 0);
+};
+
+static_assert(sizeof(Value) == 8, "NaN-boxed Value should be 8 bytes");
+
+//the top 16 bits are 0xFFF8 | tag, anything at or below 0xFFF8 is a double
+ValueType typeOf(Value val) {
+    uint64_t high = val.bits >> 48;
+    if (high <= (NANBOX_PREFIX >> 48))
+        return AS_REAL;
+    return (ValueType)(high - (NANBOX_PREFIX >> 48) - 1);
+}
+
+Value box(ValueType type, uint64_t payload) {
+    Value nv;
+    nv.bits = boxValue(type, payload);
+    return nv;
+}
+
+Value makeInt(int n) {
+    return box(AS_INT, (uint32_t)n);
+}
+
+Value makeBool(bool val) {
+    return box(AS_BOOL, val);
+}
+
+Value makeRealValue(double val) {
+    Value nv;
+    if (std::isnan(val)) nv.bits = CANONICAL_NAN;
+    else memcpy(&nv.bits, &val, sizeof(double));
+    return nv;
+}
+
+Value makeNil() {
+    return box(AS_NIL, (uint32_t)-1);
+}
+
+Value makeFunction(Function* func) {
+    return box(AS_FUNC, (uintptr_t)func);
+}
+
+Value makeString(String* str) {
+    return box(AS_STRING, (uintptr_t)str);
+}
+
+//A small string is held in the payload itself: its chars in the low 40
+//bits, its length above them and bit 47 set, which no user space pointer
+//to a String has.
+const int SMALL_STRING_MAX = 5;
+const uint64_t SMALL_STRING_BIT = 1ULL << 47;
+
+Value makeSmallString(const char* str, int len) {
+    uint64_t payload = SMALL_STRING_BIT | (uint64_t)len << 40;
+    for (int i = 0; i < len; i++)
+        payload |= (uint64_t)(uint8_t)str[i] << 8*i;
+    return box(AS_STRING, payload);
+}
+
+bool isSmallString(Value val) {
+    return (val.bits & SMALL_STRING_BIT) != 0;
+}
+
+int smallLength(Value val) {
+    return (val.bits >> 40) & 7;
+}
+
+void smallChars(Value val, char* buf) {
+    for (int i = 0; i < SMALL_STRING_MAX; i++)
+        buf[i] = (char)(val.bits >> 8*i);
+}
+
+bool sameSmallString(Value lhs, Value rhs) {
+    return lhs.bits == rhs.bits;
+}
+
+double getReal(Value val) {
+    double d;
+    memcpy(&d, &val.bits, sizeof(double));
+    return d;
+}
+
+bool getBoolean(Value val) {
+    return (val.bits & 0xFF) != 0;
+}
+
+int getInteger(Value val) {
+    return (int)(uint32_t)val.bits;
+}
+
+Function* getFunction(Value val) {
+    return (Function*)(uintptr_t)(val.bits & NANBOX_PAYLOAD);
+}
+
+String* getString(Value val) {
+    return (String*)(uintptr_t)(val.bits & NANBOX_PAYLOAD);
+}
+#else
+//A small string is held in the payload itself, zero filled past its
+//chars, and has its length in smallLen. smallLen is 0 for a String*,
+//and means nothing for the other types.
+const int SMALL_STRING_MAX = 8;
+
 struct Value {
     ValueType type;
+    int smallLen;
     union {
         String* strval;
         int intval;
         double realval;
         bool boolval;
         Function* funcval;
+        char smallStr[SMALL_STRING_MAX];
     };
 };
 
-bool isRealAnInteger(double val) {
-    string num = to_string(val);
-    int i = 0;
-    while (i < num.size() && num[i++] != '.');
-    while (i < num.size() && num[i++] == '0');
-    return i == num.size();
+ValueType typeOf(Value val) {
+    return val.type;
 }
 
 Value makeInt(int n) {
     Value nv;
     nv.type = AS_INT;
+    nv.realval = 0; //fill the whole payload, Values are copied as 8 bytes
     nv.intval = n;
     return nv;
 }
@@ -76,25 +187,20 @@ Value makeBool(bool val) {
     return nv;
 }
 
-bool isWhole(double val) {
-    return std::floor(val) == val;
-}
-
-Value makeReal(double val) {
-    if (isWhole(val)) {
-        return makeInt((int)val);
-    }
+Value makeRealValue(double val) {
     Value nv;
     nv.type = AS_REAL;
     nv.realval = val;
     return nv;
 }
+
 Value makeNil() {
     Value nv;
     nv.type = AS_NIL;
     nv.intval = -1;
     return nv;
 }
+
 Value makeFunction(Function* func) {
     Value nv;
     nv.type = AS_FUNC;
@@ -102,91 +208,37 @@ Value makeFunction(Function* func) {
     return nv;
 }
 
-Value makeString(string str) {
+Value makeString(String* str) {
     Value nv;
     nv.type = AS_STRING;
-    nv.strval = createString(str.data(), str.length());
+    nv.smallLen = 0;
+    nv.strval = str;
     return nv;
 }
 
-Value makeString(String* str) {
+Value makeSmallString(const char* str, int len) {
     Value nv;
     nv.type = AS_STRING;
-    nv.strval = str;
+    nv.smallLen = len;
+    nv.strval = nullptr;
+    memcpy(nv.smallStr, str, len);
     return nv;
 }
 
-Value concatStrings(Value lhs, Value rhs) {
-    String* lstr = lhs.strval;
-    String* rstr = rhs.strval;
-    char* tmp = new  char[lstr->len + rstr->len];
-    int k = 0, i = 0;
-    while (k < lstr->len) { tmp[k] = lstr->str[k]; k++; }
-    while (i < rstr->len) { tmp[k++] = rstr->str[i++]; }
-    String* str = new String;
-    str->str = tmp;
-    str->len = k;
-    return makeString(str);
-}
-
-Value repeatString(Value strVal, int numRepeat) {
-    string tmp;
-    for (int i = 0; i < numRepeat; i++) {
-        for (int j = 0; j < strVal.strval->len; j++) {
-            tmp.push_back(strVal.strval->str[j]);
-        }
-    }
-    return makeString(tmp);
+bool isSmallString(Value val) {
+    return val.smallLen != 0;
 }
 
-bool compareStrings(String* lhs, String* rhs) {
-    if (lhs->len != rhs->len)
-        return false;
-    int i = 0, j = 0;
-    while (i < lhs->len && j < rhs->len) {
-        if (lhs->str[i] != rhs->str[j]) {
-            return false;
-        }
-        i++; j++;
-    }
-    return i == j;
+int smallLength(Value val) {
+    return val.smallLen;
 }
 
-String* toString(Value val) {
-    switch (val.type) {
-        case AS_REAL:   {
-            string num = std::to_string(val.realval);
-            return createString(num.data(), num.length());
-        }
-        case AS_BOOL:   {
-            string num = val.boolval ? "true":"false";
-            return createString(num.data(), num.length());
-        }
-        case AS_INT:    {
-            string num = std::to_string(val.intval);
-            return createString(num.data(), num.length());
-        }
-        case AS_FUNC:   {
-            string val = "(lambda)";
-            return createString(val.data(), val.length());
-        }
-        case AS_NIL:    {
-            string val = "(nil)";
-            return createString(val.data(), val.length());
-        }
-        case AS_STRING: return val.strval;
-    }
-    return createString(" ", 1);
-}
-
-std::string toStdString(Value obj) {
-    String* str = toString(obj);
-    return string(str->str, str->len);
+void smallChars(Value val, char* buf) {
+    memcpy(buf, val.smallStr, SMALL_STRING_MAX);
 }
 
-std::ostream& operator<<(std::ostream& os, Value& val) {
-    os<<*toString(val);
-    return os;
+bool sameSmallString(Value lhs, Value rhs) {
+    return lhs.smallLen == rhs.smallLen && lhs.strval == rhs.strval;
 }
 
 double getReal(Value val) {
@@ -208,17 +260,156 @@ Function* getFunction(Value val) {
 String* getString(Value val) {
     return val.strval;
 }
+#endif
+
+bool isRealAnInteger(double val) {
+    string num = to_string(val);
+    int i = 0;
+    while (i < num.size() && num[i++] != '.');
+    while (i < num.size() && num[i++] == '0');
+    return i == num.size();
+}
+
+bool isWhole(double val) {
+    return std::floor(val) == val;
+}
+
+Value makeReal(double val) {
+    if (isWhole(val) && val >= INT_MIN && val <= INT_MAX) {
+        return makeInt((int)val);
+    }
+    return makeRealValue(val);
+}
+
+//Every string of 1 to SMALL_STRING_MAX chars is a small string, and no
+//String is one of those lengths, so a small string and a String never
+//have the same text.
+Value makeString(const char* str, int len) {
+    if (len > 0 && len <= SMALL_STRING_MAX)
+        return makeSmallString(str, len);
+    return makeString(createString(str, len));
+}
+
+Value makeString(string str) {
+    return makeString(str.data(), str.length());
+}
+
+int stringLength(Value val) {
+    return isSmallString(val) ? smallLength(val):getString(val)->len;
+}
+
+//the chars of a string value, a small string's are copied into buf
+const char* stringChars(Value val, char* buf) {
+    if (isSmallString(val)) {
+        smallChars(val, buf);
+        return buf;
+    }
+    stringHeap.flatten(getString(val));
+    return getString(val)->str;
+}
+
+//a String with the text of a string value, a small string's is interned
+String* heapString(Value val) {
+    if (!isSmallString(val))
+        return getString(val);
+    char buf[SMALL_STRING_MAX];
+    smallChars(val, buf);
+    return stringHeap.intern(buf, smallLength(val));
+}
+
+//a rope once it is long enough, otherwise both copied together
+Value concatStrings(Value lhs, Value rhs) {
+    int llen = stringLength(lhs), rlen = stringLength(rhs);
+    if (llen + rlen >= ROPE_MIN_LEN)
+        return makeString(stringHeap.concat(heapString(lhs), heapString(rhs)));
+    char lbuf[SMALL_STRING_MAX], rbuf[SMALL_STRING_MAX], text[ROPE_MIN_LEN];
+    memcpy(text, stringChars(lhs, lbuf), llen);
+    memcpy(text + llen, stringChars(rhs, rbuf), rlen);
+    return makeString(text, llen + rlen);
+}
+
+Value repeatString(Value strVal, int numRepeat) {
+    char buf[SMALL_STRING_MAX];
+    string text(stringChars(strVal, buf), stringLength(strVal));
+    string tmp;
+    for (int i = 0; i < numRepeat; i++)
+        tmp += text;
+    return makeString(tmp);
+}
+
+//two small strings are equal if their bits are, and two interned
+//strings only if they are the same String
+bool compareStrings(Value lhs, Value rhs) {
+    if (isSmallString(lhs) || isSmallString(rhs))
+        return sameSmallString(lhs, rhs);
+    String* lstr = getString(lhs);
+    String* rstr = getString(rhs);
+    if (lstr == rstr)
+        return true;
+    if (lstr->interned && rstr->interned)
+        return false;
+    if (lstr->len != rstr->len)
+        return false;
+    stringHeap.flatten(lstr);
+    stringHeap.flatten(rstr);
+    return sameText(lstr, rstr);
+}
+
+//<0, 0 or >0 as lhs sorts before, with or after rhs, as std::string does
+int orderStrings(Value lhs, Value rhs) {
+    char lbuf[SMALL_STRING_MAX], rbuf[SMALL_STRING_MAX];
+    int llen = stringLength(lhs), rlen = stringLength(rhs);
+    int common = memcmp(stringChars(lhs, lbuf), stringChars(rhs, rbuf), min(llen, rlen));
+    return common != 0 ? common:llen - rlen;
+}
+
+bool bothStrings(Value lhs, Value rhs) {
+    return typeOf(lhs) == AS_STRING && typeOf(rhs) == AS_STRING;
+}
+
+//the text of a value, without making a String of it
+std::string toStdString(Value val) {
+    switch (typeOf(val)) {
+        case AS_REAL:   return std::to_string(getReal(val));
+        case AS_BOOL:   return getBoolean(val) ? "true":"false";
+        case AS_INT:    return std::to_string(getInteger(val));
+        case AS_FUNC:   return "(lambda)";
+        case AS_NIL:    return "(nil)";
+        case AS_STRING: {
+            char buf[SMALL_STRING_MAX];
+            return string(stringChars(val, buf), stringLength(val));
+        }
+    }
+    return " ";
+}
+
+String* toString(Value val) {
+    if (typeOf(val) == AS_STRING)
+        return heapString(val);
+    string text = toStdString(val);
+    return createString(text.data(), text.length());
+}
+
+std::ostream& operator<<(std::ostream& os, Value& val) {
+    os<<toStdString(val);
+    return os;
+}
+
+inline void markValue(Value val) {
+    if (typeOf(val) == AS_STRING && !isSmallString(val))
+        stringHeap.mark(getString(val));
+}
 
 bool isNull(Value val) {
-    return val.type == AS_NIL;
+    return typeOf(val) == AS_NIL;
 }
 
 double getPrimitive(Value lhs) {
     double a = 0;
-    switch (lhs.type) {
-        case AS_INT: a = lhs.intval; break;
-        case AS_REAL: a = lhs.realval; break;
-        case AS_BOOL: a = lhs.boolval; break;
+    switch (typeOf(lhs)) {
+        case AS_INT: a = getInteger(lhs); break;
+        case AS_REAL: a = getReal(lhs); break;
+        case AS_BOOL: a = getBoolean(lhs); break;
     }
     return a;
 }
@@ -230,18 +421,92 @@ std::pair<double, double> getPrimVals(Value lhs, Value rhs) {
 }
 
 bool isZero(Value val) {
-    switch (val.type) {
-        case AS_BOOL: return val.boolval == false;
-        case AS_INT: return val.intval == 0;
-        case AS_REAL: return val.realval == 0.0;
+    switch (typeOf(val)) {
+        case AS_BOOL: return getBoolean(val) == false;
+        case AS_INT: return getInteger(val) == 0;
+        case AS_REAL: return getReal(val) == 0.0;
     }
     return false;
 }
 
+//Integer fast paths: both operands are known to be AS_INT, the
+//arithmetic stays in int and only falls back to a real on overflow.
+Value addInt(int a, int b) {
+    int r;
+    if (__builtin_add_overflow(a, b, &r))
+        return makeReal((double)a + b);
+    return makeInt(r);
+}
+
+Value subInt(int a, int b) {
+    int r;
+    if (__builtin_sub_overflow(a, b, &r))
+        return makeReal((double)a - b);
+    return makeInt(r);
+}
+
+Value mulInt(int a, int b) {
+    int r;
+    if (__builtin_mul_overflow(a, b, &r))
+        return makeReal((double)a * b);
+    return makeInt(r);
+}
+
+Value divInt(int a, int b) {
+    if (b == 0) {
+        cout<<"Error: divide by zero"<<endl;
+        return makeInt(0);
+    }
+    if (b == -1 || a % b != 0)
+        return makeReal((double)a / b);
+    return makeInt(a / b);
+}
+
+Value equInt(int a, int b) { return makeBool(a == b); }
+Value neqInt(int a, int b) { return makeBool(a != b); }
+Value lteInt(int a, int b) { return makeBool(a <= b); }
+Value gteInt(int a, int b) { return makeBool(a >= b); }
+Value ltInt(int a, int b)  { return makeBool(a < b); }
+Value gtInt(int a, int b)  { return makeBool(a > b); }
+
+//Real paths, for operands the type inference proved to be numbers
+//which aren't both ints. The result is made as the generic ops make it.
+Value addReal(double a, double b) { return makeReal(a + b); }
+Value subReal(double a, double b) { return makeReal(a - b); }
+Value mulReal(double a, double b) { return makeReal(a * b); }
+Value equReal(double a, double b) { return makeBool(a == b); }
+Value neqReal(double a, double b) { return makeBool(a != b); }
+Value lteReal(double a, double b) { return makeBool(a <= b); }
+Value gteReal(double a, double b) { return makeBool(a >= b); }
+Value ltReal(double a, double b)  { return makeBool(a < b); }
+Value gtReal(double a, double b)  { return makeBool(a > b); }
+
+//+ with a string on either side, only a long string is worth
+//making a string of the other side for, to join them in a rope
+Value concatValues(Value lhs, Value rhs) {
+    if (bothStrings(lhs, rhs))
+        return concatStrings(lhs, rhs);
+    if (typeOf(lhs) == AS_STRING && stringLength(lhs) >= ROPE_MIN_LEN)
+        return concatStrings(lhs, makeString(toStdString(rhs)));
+    if (typeOf(rhs) == AS_STRING && stringLength(rhs) >= ROPE_MIN_LEN)
+        return concatStrings(makeString(toStdString(lhs)), rhs);
+    return makeString(toStdString(lhs) + toStdString(rhs));
+}
+
+bool bothInts(Value lhs, Value rhs) {
+    return typeOf(lhs) == AS_INT && typeOf(rhs) == AS_INT;
+}
+
+double numberOf(Value val) {
+    return typeOf(val) == AS_INT ? getInteger(val):getReal(val);
+}
+
 Value Add(Value lhs, Value rhs) {
-    if (lhs.type == AS_STRING || rhs.type == AS_STRING)
-        return concatStrings(makeString(toString(lhs)), makeString(toString(rhs)));
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return addInt(getInteger(lhs), getInteger(rhs));
+    if (typeOf(lhs) == AS_STRING || typeOf(rhs) == AS_STRING)
+        return concatValues(lhs, rhs);
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeReal(a + b);
     }
@@ -249,7 +514,9 @@ Value Add(Value lhs, Value rhs) {
 }
 
 Value Sub(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return subInt(getInteger(lhs), getInteger(rhs));
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeReal(a - b);
     }    
@@ -257,14 +524,16 @@ Value Sub(Value lhs, Value rhs) {
 }
 
 Value Mul(Value lhs, Value rhs) {
-    if (lhs.type == AS_STRING || rhs.type == AS_STRING) {
-        if (lhs.type == AS_STRING) {
+    if (bothInts(lhs, rhs))
+        return mulInt(getInteger(lhs), getInteger(rhs));
+    if (typeOf(lhs) == AS_STRING || typeOf(rhs) == AS_STRING) {
+        if (typeOf(lhs) == AS_STRING) {
             return repeatString(lhs, getPrimitive(rhs));
         } else {
             return repeatString(rhs, getPrimitive(lhs));
         }
     }
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeReal(a * b);
     }    
@@ -272,7 +541,9 @@ Value Mul(Value lhs, Value rhs) {
 }
 
 Value Div(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return divInt(getInteger(lhs), getInteger(rhs));
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         if (b == 0) {
             cout<<"Error: divide by zero"<<endl;
@@ -284,7 +555,11 @@ Value Div(Value lhs, Value rhs) {
 }
 
 Value equ(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return equInt(getInteger(lhs), getInteger(rhs));
+    if (bothStrings(lhs, rhs))
+        return makeBool(compareStrings(lhs, rhs));
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeBool(a == b);
     }
@@ -292,7 +567,11 @@ Value equ(Value lhs, Value rhs) {
 }
 
 Value neq(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return neqInt(getInteger(lhs), getInteger(rhs));
+    if (bothStrings(lhs, rhs))
+        return makeBool(!compareStrings(lhs, rhs));
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeBool(a != b);
     }    
@@ -300,7 +579,11 @@ Value neq(Value lhs, Value rhs) {
 }
 
 Value lte(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return lteInt(getInteger(lhs), getInteger(rhs));
+    if (bothStrings(lhs, rhs))
+        return makeBool(orderStrings(lhs, rhs) <= 0);
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeBool(a <= b);
     }    
@@ -308,7 +591,11 @@ Value lte(Value lhs, Value rhs) {
 }
 
 Value gte(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return gteInt(getInteger(lhs), getInteger(rhs));
+    if (bothStrings(lhs, rhs))
+        return makeBool(orderStrings(lhs, rhs) >= 0);
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeBool(a >= b);
     }    
@@ -316,7 +603,11 @@ Value gte(Value lhs, Value rhs) {
 }
 
 Value lt(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return ltInt(getInteger(lhs), getInteger(rhs));
+    if (bothStrings(lhs, rhs))
+        return makeBool(orderStrings(lhs, rhs) < 0);
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeBool(a < b);
     }    
@@ -324,7 +615,11 @@ Value lt(Value lhs, Value rhs) {
 }
 
 Value gt(Value lhs, Value rhs) {
-    if ((lhs.type == AS_INT || lhs.type == AS_REAL) && (rhs.type == AS_INT || rhs.type == AS_REAL)) {
+    if (bothInts(lhs, rhs))
+        return gtInt(getInteger(lhs), getInteger(rhs));
+    if (bothStrings(lhs, rhs))
+        return makeBool(orderStrings(lhs, rhs) > 0);
+    if ((typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL) && (typeOf(rhs) == AS_INT || typeOf(rhs) == AS_REAL)) {
         auto [a, b] = getPrimVals(lhs, rhs);
         return makeBool(a > b);
     }    
@@ -332,12 +627,12 @@ Value gt(Value lhs, Value rhs) {
 }
 
 Value Neg(Value lhs) {
-    if (lhs.type == AS_INT || lhs.type == AS_REAL || lhs.type == AS_BOOL) {
+    if (typeOf(lhs) == AS_INT || typeOf(lhs) == AS_REAL || typeOf(lhs) == AS_BOOL) {
         double a = 0;
-        switch (lhs.type) {
-            case AS_INT: a = lhs.intval; break;
-            case AS_REAL: a = lhs.realval; break;
-            case AS_BOOL: a = lhs.boolval; break;
+        switch (typeOf(lhs)) {
+            case AS_INT: a = getInteger(lhs); break;
+            case AS_REAL: a = getReal(lhs); break;
+            case AS_BOOL: a = getBoolean(lhs); break;
         }
         return makeReal(-a);
     }
@@ -345,10 +640,10 @@ Value Neg(Value lhs) {
 }
 
 Value Not(Value lhs) {
-    if (lhs.type == AS_BOOL) {
+    if (typeOf(lhs) == AS_BOOL) {
         bool a;
-        switch (lhs.type) {
-            case AS_BOOL: a = lhs.boolval; break;
+        switch (typeOf(lhs)) {
+            case AS_BOOL: a = getBoolean(lhs); break;
         }
         return makeBool(!a);
     }
@@ -1,6 +1,8 @@
 #ifndef vminst_hpp
 #define vminst_hpp
+#include <cstdint>
 #include <iomanip>
+#include <vector>
 #include "value.hpp"
 using namespace std;
 
@@ -8,14 +10,28 @@ enum Inst {
     LDC, LDA, LOD, LRP,
     LDP, LDI, LDF, IXA,
     STO, STN, STP,
-    LAB, MST, ENT, CAL, 
+    LAB, MST, ENT, CAL, TCL,
     RET, JMP, JPC,
     NEG, ADD, SUB,
     MUL, DIV, MOD, NOT,
     EQU, NEQ, LTE, GTE,
     LT, GT, TS, INC, DEC,
     MATCHRE, 
-    PRINT, HALT
+    PRINT, HALT,
+    //superinstructions, produced by SuperInstructionPass
+    INCV, DECV, LADD, LSUB,
+    ADDC, SUBC, MULC,
+    ADDL, SUBL, MULL,
+    EQUJ, NEQJ, LTEJ, GTEJ,
+    LTJ, GTJ,
+    //typed forms, chosen by the code generator from TypeInference
+    NADD, NSUB, NMUL,
+    NEQU, NNEQ, NLTE, NGTE, NLT, NGT,
+    CAT,
+    //typed compare and branch, produced by SuperInstructionPass
+    NEQUJ, NNEQJ, NLTEJ, NGTEJ, NLTJ, NGTJ,
+    //produced by the loader, never by the code generator
+    LDK
 };
 
 string instStr[] = {
@@ -23,7 +39,7 @@ string instStr[] = {
     "LDP", "LDI", "LDF", "IXA",
     "STO", "STN", "STP",
     "LAB",
-    "MST", "ENT", "CAL", 
+    "MST", "ENT", "CAL", "TCL",
     "RET", "JMP", "JPC",
     "NEG", "ADD", "SUB",
     "MUL", "DIV", "MOD", "NOT",
@@ -32,19 +48,113 @@ string instStr[] = {
     "TS", "INC", "DEC", 
     "MATCHRE",
     "PRINT", 
-    "HALT"
+    "HALT",
+    "INCV", "DECV", "LADD", "LSUB",
+    "ADDC", "SUBC", "MULC",
+    "ADDL", "SUBL", "MULL",
+    "EQUJ", "NEQJ", "LTEJ", "GTEJ",
+    "LTJ", "GTJ",
+    "NADD", "NSUB", "NMUL",
+    "NEQU", "NNEQ", "NLTE", "NGTE", "NLT", "NGT",
+    "CAT",
+    "NEQUJ", "NNEQJ", "NLTEJ", "NGTEJ", "NLTJ", "NGTJ",
+    "LDK"
 };
 
+bool isBranchInst(Inst inst) {
+    switch (inst) {
+        case JMP: case JPC: case CAL: case TCL:
+        case EQUJ: case NEQJ: case LTEJ:
+        case GTEJ: case LTJ: case GTJ:
+        case NEQUJ: case NNEQJ: case NLTEJ:
+        case NGTEJ: case NLTJ: case NGTJ:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+//aux carries the small constant of superinstructions
+//which need an address, a level, and a constant.
 struct Instruction {
     Inst instruction;
     Value operand;
     Value nestlevel;
-    Instruction(Inst i = HALT, Value a = makeInt(0) , Value b = makeInt(0)) : instruction(i), operand(a), nestlevel(b) { }    
+    int aux;
+    Instruction(Inst i = HALT, Value a = makeInt(0) , Value b = makeInt(0), int c = 0) : instruction(i), operand(a), nestlevel(b), aux(c) { }    
 };
 
 std::ostream& operator<<(std::ostream& os, const Instruction& inst) {
-    os<<"("<<setw(5)<<instStr[inst.instruction]<<", "<<setw(5)<<*toString(inst.operand)<<","<<setw(5)<<" "<<*toString(inst.nestlevel)<<")";
+    os<<"("<<setw(5)<<instStr[inst.instruction]<<", "<<setw(5)<<*toString(inst.operand)<<","<<setw(5)<<" "<<*toString(inst.nestlevel);
+    if (inst.aux != 0)
+        os<<", "<<inst.aux;
+    os<<")";
     return os;
 }
 
+//The packed form the VM actually executes: every operand the
+//code generator emits is a small integer, so it is stored as an
+//immediate. LDC operands which aren't integers are moved into
+//a constant pool and the LDC becomes an LDK of their pool index.
+struct VMInstruction {
+    uint8_t instruction;
+    uint8_t nestlevel;
+    int16_t aux;
+    int32_t operand;
+};
+
+static_assert(sizeof(VMInstruction) == 8, "VMInstruction should pack into 8 bytes");
+
+int immediateOf(Value val) {
+    switch (typeOf(val)) {
+        case AS_INT:  return getInteger(val);
+        case AS_REAL: return getReal(val);
+        case AS_BOOL: return getBoolean(val);
+        default: break;
+    }
+    return 0;
+}
+
+VMInstruction decodeInstruction(Instruction& inst, vector<Value>& constants) {
+    VMInstruction vi;
+    vi.instruction = inst.instruction;
+    vi.nestlevel = getInteger(inst.nestlevel);
+    vi.aux = inst.aux;
+    vi.operand = immediateOf(inst.operand);
+    switch (inst.instruction) {
+        case LDC: {
+            if (typeOf(inst.operand) != AS_INT) {
+                vi.instruction = LDK;
+                vi.operand = constants.size();
+                constants.push_back(inst.operand);
+            }
+        } break;
+        case MATCHRE: {
+            //a literal pattern is compiled once when the VM loads the code
+            vi.operand = -1;
+            if (typeOf(inst.operand) == AS_STRING) {
+                vi.operand = constants.size();
+                constants.push_back(inst.operand);
+            }
+        } break;
+        case LAB:
+        case ENT: {
+            vi.operand = constants.size();
+            constants.push_back(inst.operand);
+        } break;
+        default:
+            break;
+    }
+    return vi;
+}
+
+void decodeCodePage(vector<Instruction>& code, vector<VMInstruction>& decoded, vector<Value>& constants) {
+    decoded.clear();
+    constants.clear();
+    decoded.reserve(code.size());
+    for (Instruction& inst : code)
+        decoded.push_back(decodeInstruction(inst, constants));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,189 @@
+#ifndef x64asm_hpp
+#define x64asm_hpp
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+//Just enough of an x86-64 assembler for the JIT's templates. Memory
+//operands are always base + index + disp32, with an index scale of 1.
+enum X64Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+const int NO_INDEX = -1;
+
+struct X64Mem {
+    X64Reg base;
+    int index;
+    int32_t disp;
+    X64Mem(X64Reg b, int i = NO_INDEX, int32_t d = 0) : base(b), index(i), disp(d) { }
+    X64Mem offset(int32_t by) const {
+        return X64Mem(base, index, disp + by);
+    }
+};
+
+//condition codes, cc^1 is the inverse of cc
+enum X64Cond {
+    CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_BE = 0x6, CC_A = 0x7, CC_S = 0x8, CC_NS = 0x9,
+    CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+enum X64Alu {
+    ALU_ADD, ALU_SUB, ALU_CMP
+};
+
+class X64Assembler {
+    private:
+        vector<uint8_t> code;
+        const uint8_t aluOpcode[3] = { 0x03, 0x2B, 0x3B };
+        const uint8_t aluDigit[3] = { 0, 5, 7 };
+        void rex(bool w, int reg, int index, int base) {
+            uint8_t r = 0x40 | (w ? 8:0) | ((reg & 8) ? 4:0) | ((index != NO_INDEX && (index & 8)) ? 2:0) | ((base & 8) ? 1:0);
+            if (r != 0x40)
+                byte(r);
+        }
+        void modrm(int reg, X64Mem m) {
+            if (m.index == NO_INDEX && (m.base & 7) != RSP) {
+                byte(0x80 | (reg & 7) << 3 | (m.base & 7));
+            } else {
+                byte(0x80 | (reg & 7) << 3 | 4);
+                byte(((m.index == NO_INDEX ? RSP:m.index) & 7) << 3 | (m.base & 7));
+            }
+            dword(m.disp);
+        }
+        void modrm(int reg, X64Reg rm) {
+            byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+        }
+        void op(bool w, int reg, X64Mem m, uint8_t op1, int op2 = -1) {
+            rex(w, reg, m.index, m.base);
+            byte(op1);
+            if (op2 >= 0)
+                byte(op2);
+            modrm(reg, m);
+        }
+        void op(bool w, int reg, X64Reg rm, uint8_t op1, int op2 = -1) {
+            rex(w, reg, NO_INDEX, rm);
+            byte(op1);
+            if (op2 >= 0)
+                byte(op2);
+            modrm(reg, rm);
+        }
+    public:
+        void clear() {
+            code.clear();
+        }
+        int size() {
+            return code.size();
+        }
+        uint8_t* data() {
+            return code.data();
+        }
+        void byte(uint8_t b) {
+            code.push_back(b);
+        }
+        void dword(int32_t d) {
+            uint8_t b[4];
+            memcpy(b, &d, 4);
+            code.insert(code.end(), b, b+4);
+        }
+        void qword(int64_t q) {
+            uint8_t b[8];
+            memcpy(b, &q, 8);
+            code.insert(code.end(), b, b+8);
+        }
+        void mov(X64Reg dst, X64Mem src) { op(true, dst, src, 0x8B); }
+        void mov(X64Mem dst, X64Reg src) { op(true, src, dst, 0x89); }
+        void mov(X64Reg dst, X64Reg src) { op(true, dst, src, 0x8B); }
+        void mov32(X64Reg dst, X64Mem src) { op(false, dst, src, 0x8B); }
+        void mov32(X64Mem dst, X64Reg src) { op(false, src, dst, 0x89); }
+        void movsxd(X64Reg dst, X64Mem src) { op(true, dst, src, 0x63); }
+        void movzx8(X64Reg dst, X64Mem src) { op(false, dst, src, 0x0F, 0xB6); }
+        //zero extends into the whole register
+        void movImm32(X64Reg dst, int32_t imm) {
+            rex(false, 0, NO_INDEX, dst);
+            byte(0xB8 + (dst & 7));
+            dword(imm);
+        }
+        void movImm64(X64Reg dst, int64_t imm) {
+            rex(true, 0, NO_INDEX, dst);
+            byte(0xB8 + (dst & 7));
+            qword(imm);
+        }
+        void movImm32(X64Mem dst, int32_t imm) {
+            op(false, 0, dst, 0xC7);
+            dword(imm);
+        }
+        //imm is sign extended
+        void movImm64(X64Mem dst, int32_t imm) {
+            op(true, 0, dst, 0xC7);
+            dword(imm);
+        }
+        void alu(X64Alu a, X64Reg dst, X64Mem src, bool w = true) { op(w, dst, src, aluOpcode[a]); }
+        void alu(X64Alu a, X64Reg dst, X64Reg src, bool w = true) { op(w, dst, src, aluOpcode[a]); }
+        void aluImm(X64Alu a, X64Reg dst, int32_t imm, bool w = true) {
+            op(w, aluDigit[a], dst, 0x81);
+            dword(imm);
+        }
+        void aluImm(X64Alu a, X64Mem dst, int32_t imm, bool w = true) {
+            op(w, aluDigit[a], dst, 0x81);
+            dword(imm);
+        }
+        void imul32(X64Reg dst, X64Mem src) { op(false, dst, src, 0x0F, 0xAF); }
+        void imul32(X64Reg dst, X64Reg src, int32_t imm) {
+            op(false, dst, src, 0x69);
+            dword(imm);
+        }
+        void shl(X64Reg dst, uint8_t by) {
+            op(true, 4, dst, 0xC1);
+            byte(by);
+        }
+        void shr(X64Reg dst, uint8_t by) {
+            op(true, 5, dst, 0xC1);
+            byte(by);
+        }
+        void lea(X64Reg dst, X64Mem src) { op(true, dst, src, 0x8D); }
+        void test32(X64Reg a, X64Reg b) { op(false, b, a, 0x85); }
+        void test(X64Reg a, X64Reg b) { op(true, b, a, 0x85); }
+        void cmp32(X64Mem m, int32_t imm) { aluImm(ALU_CMP, m, imm, false); }
+        //al := cc, then zero extended into eax
+        void setccEax(X64Cond cc) {
+            byte(0x0F); byte(0x90 + cc); byte(0xC0);
+            byte(0x0F); byte(0xB6); byte(0xC0);
+        }
+        void call(X64Reg target) { op(false, 2, target, 0xFF); }
+        //the calls and jumps to a label return where their rel32 is, for patch()
+        int call() {
+            byte(0xE8);
+            dword(0);
+            return size()-4;
+        }
+        void ret() { byte(0xC3); }
+        void push(X64Reg r) {
+            rex(false, 0, NO_INDEX, r);
+            byte(0x50 + (r & 7));
+        }
+        void pop(X64Reg r) {
+            rex(false, 0, NO_INDEX, r);
+            byte(0x58 + (r & 7));
+        }
+        int jmp() {
+            byte(0xE9);
+            dword(0);
+            return size()-4;
+        }
+        int jcc(X64Cond cc) {
+            byte(0x0F);
+            byte(0x80 + cc);
+            dword(0);
+            return size()-4;
+        }
+        void patch(int at, int target) {
+            int32_t rel = target - (at + 4);
+            memcpy(&code[at], &rel, 4);
+        }
+};
+
+#endif
\ No newline at end of file